@@ -1,60 +1,128 @@
 #include <linux/types.h>
 #include <linux/kernel.h>
-#include <linux/delay.h>
-#include <linux/ide.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/errno.h>
-#include <linux/gpio.h>
-#include <linux/cdev.h>
-#include <linux/device.h>
-#include <linux/of.h>
-#include <linux/of_address.h>
-#include <linux/of_gpio.h>
-#include <asm/mach/map.h>
+#include <linux/fs.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
 #include <asm/uaccess.h>
-#include <asm/io.h>
+#include "key_core.h"
 /***************************************************************
 文件名		: mutex.c
 版本	   	: V1.0 2024 0115
 描述	   	: gpio子系统驱动按键。
-其他	   	: 使用原子操作来实现对实现设备的互斥访问。
-			：read()来读取输入（按键值）；实际中使用input子系统用来输入；
+其他	   	: 按键的GPIO、中断与去抖在22_keycore/key_core.c中，本模块只注册/dev/key，
+			  read()读取的是去抖之后的按键状态；实际中使用input子系统用来输入；
+			：irq_mode=0(默认)时保留原来的接口：没有按下时read()立即返回INVAKEY，
+			  按住按键期间read()轮询，一直占用CPU直到松开；
+			  irq_mode=1时阻塞的read()在本文件的事件队列上睡眠，等待一次按下、松开，
+			  由去抖确认的按键事件唤醒。这会改变阻塞read()的行为(没有按下时不再立即返回)，
+			  所以需要加载时显式打开；O_NONBLOCK时没有按下返回INVAKEY，按住时返回-EAGAIN
 ***************************************************************/
-#define KEY_CNT 1	   /* 设备号个数 */
 #define KEY_NAME "key" /* 名字 */
+#define KEY0_CODE 0	   /* KEY0在key-gpios中的序号 */
 #define KEY0VALUE 0XF0 /* 按键值*/
 #define INVAKEY 0X00 /* 无效的按键值*/
 
+/*	ioctl命令：设置read()的超时时间，arg为超时时间，单位ms，0表示一直等待
+	按住按键超时read()返回-ETIMEDOUT；中断模式下一直没有按下，超时返回INVAKEY */
+#define SETTIMEOUT_CMD (_IO(0XEF, 0x1))
+
 /* key设备结构体 */
 struct key_dev
 {
-	dev_t devid;			/* 设备号 	 */
-	struct cdev cdev;		/* cdev 	*/
-	struct class *class;	/* 类 		*/
-	struct device *device;	/* 设备 	 */
-	int major;				/* 主设备号	  */
-	int minor;				/* 次设备号   */
-	struct device_node *nd; /* 设备节点 */
-	int key_gpio;			/* key所使用的GPIO编号*/
-	atomic_t keyvalue;	/*按键值*/
+	struct key_chrdev cd;	/* 字符设备，由key_core注册 */
+	atomic_t timeout_ms;	/* read()的超时时间，单位ms，0表示一直等待 */
 };
 
-struct key_dev key; /* key设备 */
+static struct key_dev key; /* key设备 */
+
+/* 读取方式：0 轮询按键状态，原来的接口；1 事件唤醒，等待期间不占用CPU，用来对比CPU占用 */
+static bool irq_mode;
+module_param(irq_mode, bool, 0444);
+MODULE_PARM_DESC(irq_mode, "sleep on the key events in read() instead of busy-polling the key state");
 
 /*
- * @description		: 打开设备
- * @param - inode 	: 传递给驱动的inode
- * @param - filp 	: 设备文件，file结构体有个叫做private_data的成员变量
- * 					  一般在open的时候将private_data指向设备结构体。
- * @return 			: 0 成功;其他 失败
+ * @description		: 中断模式：睡眠等待KEY0去抖之后的状态变为pressed。
+ * 					  本文件的事件队列只用来唤醒，醒来后清空队列再读取核心里的按键状态
+ * @param - c 		: 本文件的事件队列
+ * @param - pressed : 等待的状态，1 按下；0 松开
+ * @param - timeout : 剩余的等待时间，单位jiffies，返回时更新
+ * @return 			: 1 状态已满足；0 超时；负值 被信号打断
  */
-static int key_open(struct inode *inode, struct file *filp)
+static long key_wait_state(struct key_client *c, int pressed, long *timeout)
 {
-	filp->private_data = &key; // 设置私有数据
+	long ret;
 
+	/* 先清空旧事件再读取状态，之后的按键变化一定会在队列中留下事件 */
+	kfifo_reset_out(&c->fifo);
+	while (key_core_pressed(KEY0_CODE) != pressed)
+	{
+		ret = wait_event_interruptible_timeout(c->wait, !kfifo_is_empty(&c->fifo), *timeout);
+		if (ret <= 0)
+			return ret;
+		*timeout = ret;
+		kfifo_reset_out(&c->fifo);
+	}
+	return 1;
+}
 
-	return 0;
+/*
+ * @description		: 中断模式：睡眠等待一次完整的按下、松开
+ * @param - c 		: 本文件的事件队列
+ * @param - filp 	: 设备文件，O_NONBLOCK时不等待
+ * @return 			: KEY0VALUE 按下并松开；INVAKEY 没有按下；
+ * 					  -EAGAIN O_NONBLOCK时按键按住还没有松开；其他负值 出错或按住超时
+ */
+static int key_wait_irq(struct key_client *c, struct file *filp)
+{
+	unsigned int ms = atomic_read(&key.timeout_ms);
+	long timeout = ms ? msecs_to_jiffies(ms) : MAX_SCHEDULE_TIMEOUT;
+	long ret;
+
+	/* 1. 等待按下 */
+	if (!key_core_pressed(KEY0_CODE))
+	{
+		if (filp->f_flags & O_NONBLOCK)
+			return INVAKEY;
+		ret = key_wait_state(c, 1, &timeout);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return INVAKEY; /* 超时时间内没有按下 */
+	}
+
+	/* 2. 等待松开：O_NONBLOCK时不等待；松开的事件唤醒，等待期间不占用CPU；
+	 *    剩余的时间用来等待松开 */
+	if (filp->f_flags & O_NONBLOCK)
+		return -EAGAIN;
+	ret = key_wait_state(c, 0, &timeout);
+	if (ret < 0)
+		return ret;
+	if (!ret)
+		return -ETIMEDOUT; /* 一直按住 */
+	return KEY0VALUE;
+}
+
+/*
+ * @description		: 轮询模式：按住期间一直读取按键状态，直到松开
+ * @return 			: KEY0VALUE 按下并松开；INVAKEY 没有按下；-ETIMEDOUT 按住超时
+ */
+static int key_wait_poll(void)
+{
+	unsigned int ms = atomic_read(&key.timeout_ms);
+	unsigned long deadline = jiffies + msecs_to_jiffies(ms);
+
+	if (!key_core_pressed(KEY0_CODE))
+		return INVAKEY;
+
+	while (key_core_pressed(KEY0_CODE))
+	{
+		if (ms && time_after(jiffies, deadline))
+			return -ETIMEDOUT;
+	}
+	return KEY0VALUE;
 }
 
 /*
@@ -67,21 +135,19 @@ static int key_open(struct inode *inode, struct file *filp)
  */
 static ssize_t key_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
 {
-	int ret =0;
+	struct key_client *c = filp->private_data;
 	int value;
-	struct key_dev *dev = filp->private_data;
-	
-	if(gpio_get_value(dev->key_gpio)==0){
-		while(!gpio_get_value(dev->key_gpio));
-		atomic_set(&dev->keyvalue, KEY0VALUE);
-	}else{
-		atomic_set(&dev->keyvalue, INVAKEY);
-	}
-	value = atomic_read(&dev->keyvalue);
-	ret = copy_to_user(buf, &value, sizeof(value));
-	return ret;
-	// ret从内核空间转到用户空间，
-	// 由read(fd,readbuf,sizeof())的fd接收，并转给readbuf供用户空间使用	
+
+	/* 本文件的事件队列只允许一个读者 */
+	if (mutex_lock_interruptible(&c->read_lock))
+		return -ERESTARTSYS;
+	value = irq_mode ? key_wait_irq(c, filp) : key_wait_poll();
+	mutex_unlock(&c->read_lock);
+	if (value < 0)
+		return value;
+
+	// 由read(fd,readbuf,sizeof())的fd接收，并转给readbuf供用户空间使用
+	return copy_to_user(buf, &value, sizeof(value)) ? -EFAULT : 0;
 }
 
 /*
@@ -98,153 +164,46 @@ static ssize_t key_write(struct file *filp, const char __user *buf, size_t cnt,
 }
 
 /*
- * @description		: 关闭/释放设备
- * @param - filp 	: 要关闭的设备文件(文件描述符)
+ * @description		: ioctl函数：App调用ioctl(),向驱动发送控制信息
+ * @param - filp 	: 要打开的设备文件(文件描述符)
+ * @param - cmd 	: 应用程序发送过来的命令
+ * @param - arg 	: 参数
  * @return 			: 0 成功;其他 失败
  */
-static int key_release(struct inode *inode, struct file *filp)
+static long key_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-	struct key_dev *dev = filp->private_data;
-	gpio_free(dev->key_gpio);
-	return 0;
+	switch (cmd)
+	{
+	case SETTIMEOUT_CMD: /* 设置read()超时时间 */
+		atomic_set(&key.timeout_ms, arg);
+		return 0;
+	default: /* 其余命令(查询队列深度)交给key_core */
+		return key_client_ioctl(filp, cmd, arg);
+	}
 }
 
-/* 设备操作函数 */
+/* 设备操作函数：每个打开的文件在key_core中有自己的事件队列 */
 static struct file_operations key_fops = {
 	.owner = THIS_MODULE,
-	.open = key_open,
+	.open = key_client_open,
 	.read = key_read,
 	.write = key_write,
-	.release = key_release,
+	.unlocked_ioctl = key_unlocked_ioctl,
+	.release = key_client_release,
 };
 
 /*
- * @description	: 驱动出口函数
+ * @description	: 驱动入口函数
  * @param 		: 无
  * @return 		: 无
  */
-// 注意不能用key_init，否则会有命名冲突 
-
+// 注意不能用key_init，否则会有命名冲突
 static int __init mykey_init(void)
 {
-	int ret = 0;
-	const char *str;
-
-	/* 1. 初始化原子变量  *****************************************/
-	key.keyvalue = (atomic_t)ATOMIC_INIT(0);
-	// 2. 设置初始值 0x00
-	atomic_set(&key.keyvalue, INVAKEY);
-
-	/* 设置key所使用的GPIO */
-	/* 1、获取设备节点：key */
-	key.nd = of_find_node_by_path("/key");
-	if (key.nd == NULL)
-	{
-		printk("key node not find!\r\n");
-		return -EINVAL;
-	}
-
-	/* 2.读取status属性 */
-	ret = of_property_read_string(key.nd, "status", &str);
-	if (ret < 0)
-		return -EINVAL;
-
-	if (strcmp(str, "okay"))
-		return -EINVAL;
-
-	/* 3、获取compatible属性值并进行匹配 */
-	ret = of_property_read_string(key.nd, "compatible", &str);
-	if (ret < 0)
-	{
-		printk("key: failed to get compatible property\n");
-		return -EINVAL;
-	}
-
-	if (strcmp(str, "zhong,key"))
-	{
-		printk("key: Compatible match failed\n");
-		return -EINVAL;
-	}
-
-	/* 4、 获取设备树中的gpio属性，得到key所使用的key编号 */
-	key.key_gpio = of_get_named_gpio(key.nd, "key-gpio", 0);
-	if (key.key_gpio < 0)
-	{
-		printk("can't get key-gpio");
-		return -EINVAL;
-	}
-	printk("key-gpio num = %d\r\n", key.key_gpio);
-
-	/* 5.向gpio子系统申请使用GPIO *************/
-	ret = gpio_request(key.key_gpio, "KEY-GPIO");
-	if (ret)
-	{
-		printk(KERN_ERR "key: failed to request key-gpio\n");
-		return ret;
-	}
-
-	/* 6、设置PG3为输入模式****************/
-	ret = gpio_direction_input(key.key_gpio);
-	if (ret < 0){
-		printk("can't set gpio!\r\n");
-	}
-
-	/* 注册字符设备驱动 *********************************************************************/
-	/* 1、创建设备号 */
-	if (key.major)
-	{ /*  定义了设备号 */
-		key.devid = MKDEV(key.major, 0);
-		ret = register_chrdev_region(key.devid, KEY_CNT, KEY_NAME);
-		if (ret < 0)
-		{
-			pr_err("cannot register %s char driver [ret=%d]\n", KEY_NAME, KEY_CNT);
-			return -EIO;
-		}
-	}
-	else
-	{																 /* 没有定义设备号 */
-		ret = alloc_chrdev_region(&key.devid, 0, KEY_CNT, KEY_NAME); /* 申请设备号*/
-		if (ret < 0)
-		{
-			pr_err("%s Couldn't alloc_chrdev_region, ret=%d\r\n", KEY_NAME, ret);
-			return -EIO;
-		}
-		key.major = MAJOR(key.devid); /* 获取分配号的主设备号 */
-		key.minor = MINOR(key.devid); /* 获取分配号的次设备号 */
-	}
-	printk("key major=%d,minor=%d\r\n", key.major, key.minor);
-
-	/* 2、初始化cdev */
-	key.cdev.owner = THIS_MODULE;
-	cdev_init(&key.cdev, &key_fops);
-
-	/* 3、添加一个cdev */
-	cdev_add(&key.cdev, key.devid, KEY_CNT);
-	if (ret < 0)
-		goto del_unregister;
-
-	/* 4、创建类 */
-	key.class = class_create(THIS_MODULE, KEY_NAME);
-	if (IS_ERR(key.class))
-	{
-		goto del_cdev;
-	}
-
-	/* 5、创建设备 */
-	key.device = device_create(key.class, NULL, key.devid, NULL, KEY_NAME);
-	if (IS_ERR(key.device))
-	{
-		goto destroy_class;
-	}
-	return 0;
+	atomic_set(&key.timeout_ms, 0);
 
-destroy_class:
-	class_destroy(key.class);
-del_cdev:
-	cdev_del(&key.cdev);
-del_unregister:
-	unregister_chrdev_region(key.devid, KEY_CNT);
-	return -EIO;
+	/* 注册字符设备驱动 */
+	return key_chrdev_register(&key.cd, KEY_NAME, &key_fops);
 }
 
 /*
@@ -255,14 +214,11 @@ del_unregister:
 static void __exit mykey_exit(void)
 {
 	/* 注销字符设备驱动 */
-	cdev_del(&key.cdev);						  /*  删除cdev */
-	unregister_chrdev_region(key.devid, KEY_CNT); /* 注销设备号 */
-	device_destroy(key.class, key.devid);		  /* 注销设备 */
-	class_destroy(key.class);					  /* 注销类 */
+	key_chrdev_unregister(&key.cd);
 }
 
 module_init(mykey_init);
 module_exit(mykey_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("zhong");
-MODULE_INFO(intree, "Y");
\ No newline at end of file
+MODULE_INFO(intree, "Y");
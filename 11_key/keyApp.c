@@ -5,19 +5,55 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "errno.h"
+#include "time.h"
+#include "sys/ioctl.h"
+#include "sys/time.h"
+#include "sys/resource.h"
 /***************************************************************
 文件名		: keyApp.c
 作者	  	: 正点原子Linux团队
 版本	   	: V1.0
 描述	   	: 按键输入测试应用程序
-其他	   	: 无
-使用方法	 ：./keyApp /dev/key  
+其他	   	: 每次按键打印这次read()的耗时和期间本进程占用的CPU(用户态+内核态)，
+			  分别以insmod key.ko(轮询，默认)和insmod key.ko irq_mode=1加载驱动，
+			  对比轮询与中断两种方式按住按键时的CPU占用
+使用方法	 ：./keyApp /dev/key [timeout_ms]
+			  timeout_ms : read()的超时时间，单位ms，默认0一直等待
 ***************************************************************/
 
 /* 定义按键值 */
 #define KEY0VALUE	0XF0
 #define INVAKEY		0X00
 
+/* 设置read()超时时间，与驱动中的定义保持一致 */
+#define SETTIMEOUT_CMD	(_IO(0XEF, 0x1))
+
+/*
+ * @description		: 读取本进程已经占用的CPU时间(用户态+内核态)
+ * @return 			: CPU时间，单位us
+ */
+static long long cpu_time_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+		   ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*
+ * @description		: 读取CLOCK_MONOTONIC时间
+ * @return 			: 当前时间，单位us
+ */
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 /*
  * @description		: main主程序
  * @param - argc 	: argv数组元素个数
@@ -29,8 +65,9 @@ int main(int argc, char *argv[])
 	int fd, ret;
 	char *filename;
 	int keyvalue;
+	long long wall, cpu;
 	
-	if(argc != 2){
+	if(argc != 2 && argc != 3){
 		printf("Error Usage!\r\n");
 		return -1;
 	}
@@ -44,11 +81,27 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* 设置超时时间 */
+	if (argc == 3)
+		ioctl(fd, SETTIMEOUT_CMD, strtoul(argv[2], NULL, 0));
+
 	/* 循环读取按键值数据！ */
 	while(1) {
-		read(fd, &keyvalue, sizeof(keyvalue));
+		wall = now_us();
+		cpu = cpu_time_us();
+		ret = read(fd, &keyvalue, sizeof(keyvalue));
+		wall = now_us() - wall;
+		cpu = cpu_time_us() - cpu;
+
+		if (ret < 0) {
+			if (errno == ETIMEDOUT)
+				printf("KEY0 still held after timeout\r\n");
+			continue;
+		}
 		if (keyvalue == KEY0VALUE) {	/* KEY0 */
-			printf("KEY0 Press, value = %#X\r\n", keyvalue);	/* 按下 */
+			/* 按住期间的CPU占用：轮询方式接近100%，中断方式接近0 */
+			printf("KEY0 Press, value = %#X, read %lld ms, cpu %lld ms (%lld%%)\r\n",
+				   keyvalue, wall / 1000, cpu / 1000, wall ? cpu * 100 / wall : 0);	/* 按下 */
 		}
 	}
 
@@ -4,7 +4,7 @@
 版本                : V1.0
 描述                : Linux中断驱动实验
 其他                : 无
-使用方法            : ./keyirqApp /dev/key
+使用方法            : ./keyirqApp /dev/keyirq
 ***************************************************************/
 
 #include <stdio.h>
@@ -28,7 +28,7 @@ int main(int argc, char *argv[])
 
     /* 判断传参个数是否正确 */
     if(2 != argc) {
-        printf("Error usage: ./keyirqApp /dev/key \n");
+        printf("Error usage: ./keyirqApp /dev/keyirq \n");
         return -1;
     }
 
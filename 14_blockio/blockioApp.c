@@ -4,7 +4,10 @@
 版本                : V1.0
 描述                : Linux中断驱动实验
 其他                : 无
-使用方法            : ./keyirqApp /dev/key
+使用方法            : ./blockioApp /dev/blockio
+                      每个事件后面打印从按键边沿到应用程序读到事件的延时，
+                      分别以 insmod key_core.ko 和 insmod key_core.ko threaded_irq=1
+                      加载驱动，比较定时器去抖与线程化中断去抖的延时
 ***************************************************************/
 
 #include <stdio.h>
@@ -14,6 +17,42 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+/* 驱动的按键事件与struct input_event布局相同：
+ * type为EV_KEY，code为BTN_0 + 按键编号，value 1 按下，0 松开 */
+
+#define EVENT_BATCH 16      /* 一次read()最多读取的事件数 */
+
+/* 查询本文件队列中还没有读取的事件数，与驱动中的定义保持一致 */
+#define KEY_GETQLEN_CMD (_IOR(0XEF, 0x1, unsigned int))
+
+/*
+ * @description     : 打印读到的按键事件
+ * @param – ev      : 事件数组
+ * @param – len     : read()返回的字节数
+ * @return          : 无
+ */
+static void print_events(const struct input_event *ev, int len)
+{
+    struct timespec now;
+    long long now_us, ev_us;
+    int i;
+
+    /* 与驱动的时间戳同为CLOCK_MONOTONIC，差值即边沿到用户空间的延时(包含去抖时间) */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_us = now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+
+    for (i = 0; i < len / (int)sizeof(struct input_event); i++) {
+        ev_us = ev[i].input_event_sec * 1000000LL + ev[i].input_event_usec;
+        printf("[%ld.%03ld] Key%d %s, latency %lld us\n",
+               (long)ev[i].input_event_sec, (long)ev[i].input_event_usec / 1000,
+               ev[i].code - BTN_0, ev[i].value ? "Press" : "Release",
+               now_us - ev_us);
+    }
+}
 
 /*
  * @description		: main主程序
@@ -24,11 +63,12 @@
 int main(int argc, char *argv[])
 {
     int fd, ret;
-    int key_val;
+    unsigned int qlen;
+    struct input_event ev[EVENT_BATCH];
 
     /* 判断传参个数是否正确 */
     if(2 != argc) {
-        printf("Error usage: ./keyirqApp /dev/key \n");
+        printf("Error usage: ./blockioApp /dev/blockio \n");
         return -1;
     }
 
@@ -39,14 +79,17 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    /* 循环读取按键数据 */
+    /* 循环读取按键数据：没有事件时阻塞，有事件时一次读出所有排队的事件 */
     for ( ; ; ) {
 
-        read(fd, &key_val, sizeof(int));
-        if (0 == key_val)
-            printf("Key Press\n");
-        else if (1 == key_val)
-            printf("Key Release\n");
+        ret = read(fd, ev, sizeof(ev));
+        if (ret < 0)
+            break;
+        print_events(ev, ret);
+
+        /* 一次read()之后队列里还剩的事件数：持续不为0说明读得比按键慢 */
+        if (0 == ioctl(fd, KEY_GETQLEN_CMD, &qlen) && qlen)
+            printf("%u events still queued\n", qlen);
     }
 
     /* 关闭设备 */
@@ -0,0 +1,130 @@
+/***************************************************************
+文件名              : uringbenchApp.c
+作者                : 正点原子Linux团队
+版本                : V1.0
+描述                : 用io_uring异步读取按键事件，统计按键边沿到完成的延时
+其他                : 需要liburing，交叉编译时sysroot中要有liburing的头文件和库，
+                      单独用make uring_gcc编译，不在默认的build中；
+                      5.4内核没有IORING_OP_READ(5.6加入)，用IORING_OP_READV读取
+使用方法            : ./uringbenchApp /dev/blockio [count]
+                      count : 统计多少次读取完成之后打印结果并退出，默认100
+                      驱动的read_iter支持IOCB_NOWAIT，队列中有事件时读请求在提交时就完成，
+                      没有事件时io_uring等poll就绪再重试(5.7及以后的内核)，不占用工作线程
+***************************************************************/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <linux/input.h>
+#include <liburing.h>
+
+#define EVENT_BATCH 16      /* 一次读请求最多读取的事件数 */
+#define DEFAULT_COUNT 100   /* 默认统计的读取次数 */
+
+/*
+ * @description     : 读取CLOCK_MONOTONIC时间，与驱动的事件时间戳是同一个时钟
+ * @return          : 当前时间，单位us
+ */
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * @description		: main主程序
+ * @param – argc		: argv数组元素个数
+ * @param – argv		: 具体参数
+ * @return			: 0 成功;其他 失败
+ */
+int main(int argc, char *argv[])
+{
+    struct io_uring ring;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct input_event ev[EVENT_BATCH];
+    struct iovec iov = { .iov_base = ev, .iov_len = sizeof(ev) };
+    long long t_done, ev_us, lat;
+    long long lat_min = -1, lat_max = 0, lat_sum = 0, nr_events = 0;
+    int count = DEFAULT_COUNT;
+    int fd, ret, i, n, done;
+
+    /* 判断传参个数是否正确 */
+    if(2 != argc && 3 != argc) {
+        printf("Error usage: ./uringbenchApp /dev/blockio [count]\n");
+        return -1;
+    }
+    if (3 == argc)
+        count = atoi(argv[2]);
+    if (0 >= count) {
+        printf("ERROR: invalid count %s\n", argv[2]);
+        return -1;
+    }
+
+    /* 打开设备：阻塞方式打开，是否等待由io_uring决定 */
+    fd = open(argv[1], O_RDONLY);
+    if(0 > fd) {
+        printf("ERROR: %s file open failed!\n", argv[1]);
+        return -1;
+    }
+
+    ret = io_uring_queue_init(4, &ring, 0);
+    if (0 > ret) {
+        printf("ERROR: io_uring_queue_init failed, %s\n", strerror(-ret));
+        close(fd);
+        return -1;
+    }
+
+    /* 每次只有一个读请求在队列中：完成之后统计延时，再提交下一个 */
+    for (done = 0; done < count; done++) {
+        sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_readv(sqe, fd, &iov, 1, 0);
+        io_uring_submit(&ring);
+
+        ret = io_uring_wait_cqe(&ring, &cqe);
+        t_done = now_us();
+        if (0 > ret) {
+            printf("ERROR: io_uring_wait_cqe failed, %s\n", strerror(-ret));
+            break;
+        }
+        ret = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        if (0 > ret) {
+            printf("ERROR: read failed, %s\n", strerror(-ret));
+            break;
+        }
+
+        /* 每个事件的延时：从按键边沿(包含去抖时间)到读请求完成 */
+        n = ret / (int)sizeof(struct input_event);
+        for (i = 0; i < n; i++) {
+            ev_us = ev[i].input_event_sec * 1000000LL + ev[i].input_event_usec;
+            lat = t_done - ev_us;
+            printf("[%ld.%03ld] Key%d %s, latency %lld us\n",
+                   (long)ev[i].input_event_sec, (long)ev[i].input_event_usec / 1000,
+                   ev[i].code - BTN_0, ev[i].value ? "Press" : "Release", lat);
+            if (0 > lat_min || lat < lat_min)
+                lat_min = lat;
+            if (lat > lat_max)
+                lat_max = lat;
+            lat_sum += lat;
+            nr_events++;
+        }
+    }
+
+    if (nr_events)
+        printf("%d reads, %lld events, latency min %lld us, avg %lld us, max %lld us\n",
+               done, nr_events, lat_min, lat_sum / nr_events, lat_max);
+
+    /* 关闭设备 */
+    io_uring_queue_exit(&ring);
+    close(fd);
+    return 0;
+}
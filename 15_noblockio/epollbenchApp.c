@@ -0,0 +1,157 @@
+/***************************************************************
+Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
+文件名           : epollbenchApp.c
+作者             : 正点原子Linux团队
+版本             : V1.0
+描述             : 多个文件描述符同时监视按键时的epoll唤醒开销测试
+其他             : 同一个按键事件会分发到每个打开的文件，
+                   一次按键对应nfds个文件同时就绪
+使用方法         : ./epollbenchApp /dev/noblockio [nfds] [exclusive]
+                   nfds      : 打开的文件个数，默认100
+                   exclusive : 1 注册时加上EPOLLEXCLUSIVE
+                   每次epoll_wait()返回打印：就绪的文件数、读到的事件数、
+                   从按键边沿到epoll_wait()返回的延时、读完所有就绪文件的耗时
+论坛             : www.openedv.com
+***************************************************************/
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <linux/input.h>
+
+#define DEFAULT_NFDS 100    /* 默认打开的文件个数 */
+#define EVENT_BATCH 16      /* 一次read()最多读取的事件数 */
+
+/*
+ * @description     : 读取CLOCK_MONOTONIC时间，与驱动的事件时间戳是同一个时钟
+ * @return          : 当前时间，单位us
+ */
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * @description     : 边沿触发：把一个文件中的事件全部读完，直到-EAGAIN
+ * @param – fd      : 文件描述符
+ * @param – edge_us : 返回最早一个事件的时间戳，单位us；没有事件时不修改
+ * @return          : 读到的事件数
+ */
+static int drain_fd(int fd, long long *edge_us)
+{
+    struct input_event ev[EVENT_BATCH];
+    long long ts;
+    int ret, i, cnt = 0;
+
+    while ((ret = read(fd, ev, sizeof(ev))) > 0) {
+        for (i = 0; i < ret / (int)sizeof(struct input_event); i++) {
+            ts = ev[i].input_event_sec * 1000000LL + ev[i].input_event_usec;
+            if (!*edge_us || ts < *edge_us)
+                *edge_us = ts;
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
+
+/*
+ * @description     : main主程序
+ * @param – argc        : argv数组元素个数
+ * @param – argv        : 具体参数
+ * @return          : 0 成功;其他 失败
+ */
+int main(int argc, char *argv[])
+{
+    struct epoll_event ev, *events;
+    long long t_wake, t_done, edge_us;
+    int *fds;
+    int nfds = DEFAULT_NFDS;
+    int exclusive = 0;
+    int epfd, n, i, cnt;
+
+    /* 判断传参个数是否正确 */
+    if(2 > argc || 4 < argc) {
+        printf("Usage:\n"
+               "\t./epollbenchApp /dev/noblockio [nfds] [exclusive]\n"
+              );
+        return -1;
+    }
+    if (3 <= argc)
+        nfds = atoi(argv[2]);
+    if (4 == argc)
+        exclusive = atoi(argv[3]);
+    if (0 >= nfds) {
+        printf("ERROR: invalid nfds %s\n", argv[2]);
+        return -1;
+    }
+
+    fds = calloc(nfds, sizeof(int));
+    events = calloc(nfds, sizeof(struct epoll_event));
+    if (!fds || !events) {
+        printf("ERROR: out of memory\n");
+        return -1;
+    }
+
+    epfd = epoll_create1(0);
+    if (0 > epfd) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    /* 打开nfds个文件，每个文件在驱动里都有自己的事件队列和等待队列 */
+    for (i = 0; i < nfds; i++) {
+        fds[i] = open(argv[1], O_RDONLY | O_NONBLOCK);
+        if(0 > fds[i]) {
+            printf("ERROR: %s file open failed at fd #%d!\n", argv[1], i);
+            return -1;
+        }
+
+        /* 边沿触发：只有新事件到来才会再次就绪，就绪之后必须读到-EAGAIN */
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET | (exclusive ? EPOLLEXCLUSIVE : 0);
+        ev.data.u32 = i;
+        if (0 > epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev)) {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+    printf("%d fds in epoll set%s, waiting for key events...\n",
+           nfds, exclusive ? " (EPOLLEXCLUSIVE)" : "");
+
+    for ( ; ; ) {
+        n = epoll_wait(epfd, events, nfds, -1);
+        if (0 > n) {
+            perror("epoll_wait");
+            break;
+        }
+        t_wake = now_us();
+
+        /* 读完所有就绪的文件，统计读取的耗时 */
+        edge_us = 0;
+        cnt = 0;
+        for (i = 0; i < n; i++)
+            cnt += drain_fd(fds[events[i].data.u32], &edge_us);
+        t_done = now_us();
+
+        printf("ready %3d/%d fds, %4d events, edge->wake %lld us, drain %lld us (%lld ns/fd)\n",
+               n, nfds, cnt, edge_us ? t_wake - edge_us : 0LL,
+               t_done - t_wake, (t_done - t_wake) * 1000 / n);
+    }
+
+    /* 关闭设备 */
+    for (i = 0; i < nfds; i++)
+        close(fds[i]);
+    close(epfd);
+    free(events);
+    free(fds);
+    return 0;
+}
@@ -5,7 +5,7 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 版本             : V1.0
 描述             : 以非阻塞方式读取按键状态
 其他             : 无
-使用方法         : ./keyApp /dev/key
+使用方法         : ./keyApp /dev/noblockio
 论坛             : www.openedv.com
 日志             : 初版V1.0 2021/01/19 正点原子Linux团队创建
 ***************************************************************/
@@ -16,8 +16,31 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/input.h>
 #include <poll.h>
 
+/* 驱动的按键事件与struct input_event布局相同：
+ * type为EV_KEY，code为BTN_0 + 按键编号，value 1 按下，0 松开 */
+
+#define EVENT_BATCH 16      /* 一次read()最多读取的事件数 */
+
+/*
+ * @description     : 打印读到的按键事件
+ * @param – ev      : 事件数组
+ * @param – len     : read()返回的字节数
+ * @return          : 无
+ */
+static void print_events(const struct input_event *ev, int len)
+{
+    int i;
+
+    for (i = 0; i < len / (int)sizeof(struct input_event); i++) {
+        printf("[%ld.%03ld] Key%d %s\n",
+               (long)ev[i].input_event_sec, (long)ev[i].input_event_usec / 1000,
+               ev[i].code - BTN_0, ev[i].value ? "Press" : "Release");
+    }
+}
+
 /*
  * @description     : main主程序
  * @param – argc        : argv数组元素个数
@@ -27,14 +50,14 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 int main(int argc, char *argv[])
 {
     fd_set readfds;
-    int key_val;
+    struct input_event ev[EVENT_BATCH];
     int fd;
     int ret;
 
     /* 判断传参个数是否正确 */
     if(2 != argc) {
         printf("Usage:\n"
-               "\t./keyApp /dev/key\n"
+               "\t./keyApp /dev/noblockio\n"
               );
         return -1;
     }
@@ -46,12 +69,13 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    FD_ZERO(&readfds);
-    FD_SET(fd, &readfds);
-
     /* 循环轮训读取按键数据 */
     for ( ; ; ) {
 
+        /* select()返回时会修改readfds，每次都要重新设置 */
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+
         ret = select(fd + 1, &readfds, NULL, NULL, NULL);
         switch (ret) {
 
@@ -65,11 +89,9 @@ int main(int argc, char *argv[])
 
         default:
             if(FD_ISSET(fd, &readfds)) {
-                read(fd, &key_val, sizeof(int));
-                if (0 == key_val)
-                    printf("Key Press\n");
-                else if (1 == key_val)
-                    printf("Key Release\n");
+                ret = read(fd, ev, sizeof(ev));
+                if (ret > 0)
+                    print_events(ev, ret);
             }
 
             break;
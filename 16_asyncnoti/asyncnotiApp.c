@@ -5,7 +5,7 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 版本                   : V1.0
 描述                   : 异步通知测试程序
 其他                   : 无
-使用方法               : ./asyncKeyApp /dev/key
+使用方法               : ./asyncKeyApp /dev/asyncnoti
 
 异步通知（信号）机制依赖于异步通知的请求，即在用户空间程序中使用相关的系统调用
 （如 fcntl 中的 F_SETOWN 和 F_SETFL）来设置异步通知
@@ -18,10 +18,33 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/input.h>
 #include <signal.h>
 
 static int fd;
 
+/* 驱动的按键事件与struct input_event布局相同：
+ * type为EV_KEY，code为BTN_0 + 按键编号，value 1 按下，0 松开 */
+
+#define EVENT_BATCH 16      /* 一次read()最多读取的事件数 */
+
+/*
+ * @description     : 打印读到的按键事件
+ * @param – ev      : 事件数组
+ * @param – len     : read()返回的字节数
+ * @return          : 无
+ */
+static void print_events(const struct input_event *ev, int len)
+{
+    int i;
+
+    for (i = 0; i < len / (int)sizeof(struct input_event); i++) {
+        printf("[%ld.%03ld] Key%d %s\n",
+               (long)ev[i].input_event_sec, (long)ev[i].input_event_usec / 1000,
+               ev[i].code - BTN_0, ev[i].value ? "Press" : "Release");
+    }
+}
+
 /*
  * SIGIO信号处理函数
  * @param – signum		: 信号值
@@ -29,13 +52,12 @@ static int fd;
  */
 static void sigio_signal_func(int signum)
 {
-    unsigned int key_val = 0;
+    struct input_event ev[EVENT_BATCH];
+    int ret;
 
-    read(fd, &key_val, sizeof(unsigned int));
-    if (0 == key_val)
-        printf("Key Press\n");
-    else if (1 == key_val)
-        printf("Key Release\n");
+    /* 非阻塞读，一个信号可能对应多个事件，读到-EAGAIN为止 */
+    while ((ret = read(fd, ev, sizeof(ev))) > 0)
+        print_events(ev, ret);
 }
 
 
@@ -52,7 +74,7 @@ int main(int argc, char *argv[])
     /* 判断传参个数是否正确 */
     if(2 != argc) {
         printf("Usage:\n"
-               "\t./asyncKeyApp /dev/key\n"
+               "\t./asyncKeyApp /dev/asyncnoti\n"
               );
         return -1;
     }
@@ -67,8 +89,8 @@ int main(int argc, char *argv[])
     /* 设置信号SIGIO的处理函数 */
     signal(SIGIO, sigio_signal_func);       // 收到SIGIO信号，调用sigio_signal_func函数处理
     fcntl(fd, F_SETOWN, getpid());			// 将当前进程的进程号告诉给内核
-    flags = fcntl(fd, F_GETFD);				// 获取当前的进程状态
-    fcntl(fd, F_SETFL, flags | FASYNC);		// 设置进程启用异步通知功能
+    flags = fcntl(fd, F_GETFL);				// 获取文件状态标志(F_GETFD得到的是fd标志，不能用)
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK | FASYNC);	// 启用异步通知，保持非阻塞：信号处理函数读空队列时不会挂起
 
 
     /* 循环轮询读取按键数据 */
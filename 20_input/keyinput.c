@@ -4,7 +4,29 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 作者	  	: 正点原子Linux团队
 版本	   	: V1.0
 描述	   	: Linux按键input子系统实验
-其他	   	: 无
+其他	   	: 一个platform设备注册一个input_dev，支持两种设备树写法：
+			  1. 没有row-gpios：独立按键。GPIO、中断与去抖在22_keycore/key_core.c中
+			     (设备树/key节点的key-gpio/key-gpios)，本驱动只是key_core的一个订阅者，
+			     在notify()里把去抖之后的事件转换成input事件；linux,keycodes按key_core的
+			     按键顺序给出键值，没有给出时只有一个按键为KEY_0，否则为BTN_0 + 序号。
+			     key_core逐个按键去抖，几个按键同时按下时每个按键各同步一次
+			  2. row-gpios + col-gpios：行列矩阵键盘，行为带中断的输入，列为输出，
+			     linux,keymap给出键值，每项为MATRIX_KEY(行, 列, 键值)；
+			     col-scan-delay-us为驱动一列之后到读取行的等待时间，默认10us。
+			     debounce-delay-ms为去抖时间，默认15ms。每次扫描读取所有按键，
+			     状态改变的按键全部上报之后只调用一次input_sync()，
+			     几个按键同时按下只唤醒一次应用程序。
+			     行GPIO没有中断时改为轮询(input_setup_polling)：有按键按下时按
+			     poll-interval-min-ms扫描，空闲时扫描间隔每次加倍，直到poll-interval-max-ms；
+			     轮询只在/dev/input/eventX被打开时运行。
+			     模块参数mask_irq=1时使用原来的去抖方式：第一个边沿屏蔽所有行中断，
+			     扫描之后再打开；默认0时中断一直打开，每个边沿推迟去抖定时器。
+			     两种方式丢失/多出的事件用keystormApp对比
+			  每个设备树节点有自己的按键设备(devm_kzalloc)，多个节点互不影响。
+			  手势：linux,long-press-map和linux,double-click-map由<键值 手势键值>成对组成，
+			  这些按键不再上报原始的按下/松开，而是识别之后上报一次手势键值的按下+松开：
+			  按住long-press-ms(默认1000ms)为长按，松开之后double-click-ms(默认300ms)内
+			  再次按下为双击，否则为单击(上报原来的键值)；其他按键照常上报，EV_REP产生重复
 ***************************************************************/
 #include <linux/module.h>
 #include <linux/errno.h>
@@ -12,103 +34,756 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 #include <linux/platform_device.h>
 #include <linux/of_gpio.h>
 #include <linux/input.h>
+#include <linux/input/matrix_keypad.h>
 #include <linux/timer.h>
-#include <linux/of_irq.h>
+#include <linux/delay.h>
+#include <linux/bitmap.h>
 #include <linux/interrupt.h>
+#include "key_core.h"
 
 #define KEYINPUT_NAME		"keyinput"	/* 名字 		*/
+#define KEY_MAX_GPIOS		8			/* row-gpios、col-gpios最多的GPIO个数 */
+#define KEY_MAX_KEYS		(KEY_MAX_GPIOS * KEY_MAX_GPIOS)	/* 最多的按键个数 */
+#define KEY_DEBOUNCE_MS		15			/* 默认去抖时间 */
+#define KEY_COL_DELAY_US	10			/* 默认矩阵键盘驱动列之后行电平稳定的时间 */
+#define KEY_POLL_MIN_MS		20			/* 默认最短轮询间隔，有按键按下时使用 */
+#define KEY_POLL_MAX_MS		200			/* 默认最长轮询间隔，空闲时退避到这里 */
+#define KEY_LONG_PRESS_MS	1000		/* 默认长按时间 */
+#define KEY_DOUBLE_CLICK_MS	300			/* 默认双击间隔 */
+
+/* 矩阵键盘的去抖方式：0 中断一直打开，每个边沿推迟定时器，抖动合并成一次扫描；
+ * 1 原来的方式，第一个边沿屏蔽所有行中断，扫描之后再打开，用来对比两种方式 */
+static bool mask_irq;
+module_param(mask_irq, bool, 0444);
+MODULE_PARM_DESC(mask_irq, "mask the row irqs from the first edge until the debounce scan (old design)");
+
+/* 按键的接法 */
+enum key_mode {
+	KEY_MODE_DIRECT,	/* 每个按键一个GPIO，由key_core管理 */
+	KEY_MODE_MATRIX,	/* 行列矩阵键盘 */
+};
+
+/* 一个GPIO */
+struct key_gpio {
+	int gpio;			/* GPIO编号 */
+	bool active_low;	/* GPIO_ACTIVE_LOW：低电平有效 */
+	int irq;			/* 中断号，矩阵键盘的列没有中断 */
+	char name[16];		/* GPIO和中断的名字 */
+};
+
+/* 按键手势识别的状态 */
+enum key_gesture_state {
+	KEY_GS_IDLE,		/* 松开 */
+	KEY_GS_DOWN,		/* 第一次按下，等待松开或者长按时间到 */
+	KEY_GS_LONG,		/* 已经上报长按，等待松开 */
+	KEY_GS_UP,			/* 第一次松开，等待第二次按下或者双击时间到 */
+	KEY_GS_DOWN2,		/* 已经上报双击，等待松开 */
+};
+
+/* 一个按键的手势识别 */
+struct key_gesture {
+	unsigned short long_code;	/* 长按的键值，0表示不识别长按 */
+	unsigned short dbl_code;	/* 双击的键值，0表示不识别双击 */
+	enum key_gesture_state state;
+	unsigned long deadline;		/* 长按或者双击的等待时间到期的时刻，jiffies */
+};
 
 /* key设备结构体 */
 struct key_dev{
 	struct input_dev *idev;  /* 按键对应的input_dev指针 */
 	struct timer_list timer; /* 消抖定时器 */
-	int gpio_key;			 /* 按键对应的GPIO编号 */
-	int irq_key;			 /* 按键对应的中断号 */
+	enum key_mode mode;		 /* 按键的接法 */
+	struct key_subscriber sub;	/* 独立按键：订阅key_core去抖之后的事件 */
+	struct key_gpio rows[KEY_MAX_GPIOS];	/* 矩阵键盘的行 */
+	int nrows;
+	struct key_gpio cols[KEY_MAX_GPIOS];	/* 矩阵键盘的列 */
+	int ncols;
+	int nkeys;				 /* 按键个数，独立按键为key_core的按键数，矩阵键盘为nrows * ncols */
+	unsigned int debounce_ms;	/* 去抖时间 */
+	unsigned int col_delay_us;	/* 矩阵键盘驱动一列之后到读取行的等待时间 */
+	bool scanning;			 /* 矩阵键盘正在扫描，忽略行中断 */
+	atomic_t masked;		 /* mask_irq=1：行中断已屏蔽，等待定时器扫描 */
+	unsigned long rows_expect;	/* 矩阵键盘：按上一次扫描结果，空闲时有按键按下的行，第r位为第r行 */
+	bool polled;			 /* GPIO没有中断，轮询按键 */
+	unsigned int poll_min_ms;	/* 轮询间隔的下限 */
+	unsigned int poll_max_ms;	/* 轮询间隔的上限 */
+	DECLARE_BITMAP(pending, KEY_MAX_KEYS);	/* 轮询时上一次读到、还没有确认的按键状态 */
+	unsigned short keycode[KEY_MAX_KEYS];	/* 扫描码对应的键值，扫描码 = 行 * ncols + 列 */
+	DECLARE_BITMAP(state, KEY_MAX_KEYS);	/* 上一次扫描的按键状态，1按下 */
+	struct key_gesture gestures[KEY_MAX_KEYS];	/* 每个扫描码的手势识别 */
+	unsigned int long_press_ms;	/* 长按时间 */
+	unsigned int double_click_ms;	/* 双击间隔 */
+	struct timer_list gesture_timer;	/* 长按、双击的等待定时器 */
+	spinlock_t lock;		 /* 保护gestures，扫描、key_core的notify()(可能在硬中断里)和手势定时器可能同时运行 */
 };
 
-static struct key_dev key;          /* 按键设备 */
+/*
+ * @description		: 读取一个输入GPIO，按GPIO_ACTIVE_xxx统一成按下/松开
+ * @param – kg		: GPIO
+ * @return			: 1 按下；0 松开
+ */
+static int key_gpio_pressed(struct key_gpio *kg)
+{
+	return !gpio_get_value(kg->gpio) == kg->active_low;
+}
+
+/*
+ * @description		: 驱动或者放开矩阵键盘的一列；不驱动时设置为输入(高阻)，
+ * 					  两个按键在同一行时不会把两列短路
+ * @param – kg		: 列的GPIO
+ * @param – on		: true 输出有效电平；false 高阻
+ * @return			: 无
+ */
+static void key_col_drive(struct key_gpio *kg, bool on)
+{
+	if (on)
+		gpio_direction_output(kg->gpio, !kg->active_low);
+	else
+		gpio_direction_input(kg->gpio);
+}
+
+/*
+ * @description		: 矩阵键盘所有列都驱动时读取所有行
+ * @param – dev		: 按键设备
+ * @return			: 有按键按下的行，第r位为第r行
+ */
+static unsigned long key_read_rows(struct key_dev *dev)
+{
+	unsigned long rows = 0;
+	int r;
+
+	for (r = 0; r < dev->nrows; r++)
+		if (key_gpio_pressed(&dev->rows[r]))
+			rows |= BIT(r);
+	return rows;
+}
 
 /*
- * @description		: 按键中断服务函数
+ * @description		: 屏蔽或者打开所有行中断，mask_irq=1时使用
+ * @param – dev		: 按键设备
+ * @param – on		: true 打开；false 屏蔽
+ * @return			: 无
+ */
+static void key_irq_enable(struct key_dev *dev, bool on)
+{
+	int i;
+
+	for (i = 0; i < dev->nrows; i++) {
+		if (on)
+			enable_irq(dev->rows[i].irq);
+		else
+			disable_irq_nosync(dev->rows[i].irq);
+	}
+}
+
+/*
+ * @description		: 矩阵键盘行中断服务函数，所有行共用
  * @param – irq		: 触发该中断事件对应的中断号
- * @param – arg		: arg参数可以在申请中断的时候进行配置
+ * @param – dev_id	: 按键设备
  * @return			: 中断执行结果
  */
 static irqreturn_t key_interrupt(int irq, void *dev_id)
 {
-	if(key.irq_key != irq)
-		return IRQ_NONE;
-	
-	/* 按键防抖处理，开启定时器延时15ms */
-	disable_irq_nosync(irq); /* 禁止按键中断 */
-	mod_timer(&key.timer, jiffies + msecs_to_jiffies(15));
-	
+	struct key_dev *dev = dev_id;
+
+	/* mask_irq=1：已经有一次扫描在等待，这个边沿在扫描时一起读取；
+	 * 否则屏蔽所有行中断，debounce_ms之后扫描，去抖期间的边沿不再进入 */
+	if (mask_irq) {
+		if (atomic_xchg(&dev->masked, 1))
+			return IRQ_HANDLED;
+		key_irq_enable(dev, false);
+		mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->debounce_ms));
+		return IRQ_HANDLED;
+	}
+
+	/* 扫描时驱动列产生的行中断，不是按键动作 */
+	if (smp_load_acquire(&dev->scanning))
+		return IRQ_HANDLED;
+
+	/* 各行电平和上一次扫描的结果一致，是扫描结束重新驱动列之后迟到的边沿
+	 * (可能在另一个CPU上)，或者抖动回到了原来的状态，不需要再扫描；
+	 * 否则按住按键时每次扫描都会产生边沿，又启动下一次扫描 */
+	if (key_read_rows(dev) == READ_ONCE(dev->rows_expect))
+		return IRQ_HANDLED;
+
+	/* 按键防抖处理：中断一直打开，每个边沿都把定时器推迟到debounce_ms之后，
+	 * 抖动中的所有边沿合并成最后一次扫描，去抖期间的边沿也不会丢失；
+	 * 到期时间没有变化时mod_timer()直接返回 */
+	mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->debounce_ms));
+
     return IRQ_HANDLED;
 }
 
 /*
- * @description			: 按键初始化函数
+ * @description		: 扫描矩阵键盘，读取所有按键的状态
+ * @param – dev		: 按键设备
+ * @param – state	: 返回按键状态，第n位为扫描码n的按键，1按下
+ * @return			: 无
+ */
+static void key_scan(struct key_dev *dev, unsigned long *state)
+{
+	unsigned long expect = 0;
+	int r, c;
+
+	bitmap_zero(state, KEY_MAX_KEYS);
+
+	/* 1. 放开所有列，再逐列驱动，读取所有行；
+	 *    扫描期间行上的边沿由key_interrupt()忽略 */
+	WRITE_ONCE(dev->scanning, true);
+	for (c = 0; c < dev->ncols; c++)
+		key_col_drive(&dev->cols[c], false);
+
+	for (c = 0; c < dev->ncols; c++) {
+		key_col_drive(&dev->cols[c], true);
+		if (dev->col_delay_us)
+			udelay(dev->col_delay_us);
+
+		for (r = 0; r < dev->nrows; r++)
+			if (key_gpio_pressed(&dev->rows[r]))
+				__set_bit(r * dev->ncols + c, state);
+
+		key_col_drive(&dev->cols[c], false);
+	}
+
+	/* 2. 空闲时驱动所有列，任何一个按键按下或松开都会触发行中断；
+	 *    等行电平稳定之后再接收中断 */
+	for (c = 0; c < dev->ncols; c++)
+		key_col_drive(&dev->cols[c], true);
+	if (dev->col_delay_us)
+		udelay(dev->col_delay_us);
+
+	/* 3. 由扫描结果得到空闲时有按键按下的行，key_interrupt()用它过滤边沿 */
+	for (r = 0; r < dev->nrows; r++)
+		for (c = 0; c < dev->ncols; c++)
+			if (test_bit(r * dev->ncols + c, state))
+				expect |= BIT(r);
+	WRITE_ONCE(dev->rows_expect, expect);
+	smp_store_release(&dev->scanning, false);
+
+	/* 4. 扫描期间真实的按下或松开的边沿被忽略了：再读一次行，
+	 *    和扫描结果不一致就在debounce_ms之后重新扫描。轮询时由key_poll()负责；
+	 *    mask_irq=1时保持原来的行为，不重新扫描 */
+	if (!dev->polled && !mask_irq && key_read_rows(dev) != expect)
+		mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->debounce_ms));
+}
+
+/*
+ * @description		: 上报一次单击：按下之后立即松开，由调用者同步
+ * @param – dev		: 按键设备
+ * @param – scan	: 扫描码
+ * @param – code	: 键值
+ * @return			: 无
+ */
+static void key_tap(struct key_dev *dev, int scan, unsigned int code)
+{
+	input_event(dev->idev, EV_MSC, MSC_SCAN, scan);
+	input_report_key(dev->idev, code, 1);
+	input_report_key(dev->idev, code, 0);
+}
+
+/*
+ * @description		: 按照最早到期的长按、双击等待时间设置手势定时器，
+ * 					  没有等待的按键时删除定时器；调用者持有dev->lock
+ * @param – dev		: 按键设备
+ * @return			: 无
+ */
+static void key_gesture_arm(struct key_dev *dev)
+{
+	struct key_gesture *g;
+	unsigned long expires = 0;
+	bool armed = false;
+	int i;
+
+	for (i = 0; i < dev->nkeys; i++) {
+		g = &dev->gestures[i];
+		if (g->state != KEY_GS_UP && !(g->state == KEY_GS_DOWN && g->long_code))
+			continue;
+		if (!armed || time_before(g->deadline, expires))
+			expires = g->deadline;
+		armed = true;
+	}
+
+	if (armed)
+		mod_timer(&dev->gesture_timer, expires);
+	else
+		del_timer(&dev->gesture_timer);
+}
+
+/*
+ * @description		: 识别手势的按键按下或者松开时推进状态机；调用者持有dev->lock
+ * @param – dev		: 按键设备
+ * @param – scan	: 扫描码
+ * @param – pressed	: 1 按下；0 松开
+ * @return			: true 上报了事件，需要同步
+ */
+static bool key_gesture_event(struct key_dev *dev, int scan, int pressed)
+{
+	struct key_gesture *g = &dev->gestures[scan];
+
+	if (pressed) {
+		/* 1. 松开之后双击时间内再次按下：双击，立即上报，忽略这次松开 */
+		if (g->state == KEY_GS_UP) {
+			key_tap(dev, scan, g->dbl_code);
+			g->state = KEY_GS_DOWN2;
+			return true;
+		}
+		/* 2. 第一次按下：开始等待长按 */
+		g->state = KEY_GS_DOWN;
+		g->deadline = jiffies + msecs_to_jiffies(dev->long_press_ms);
+		return false;
+	}
+
+	/* 3. 长按时间之前松开：识别双击时等待第二次按下，否则就是单击 */
+	if (g->state == KEY_GS_DOWN) {
+		if (g->dbl_code) {
+			g->state = KEY_GS_UP;
+			g->deadline = jiffies + msecs_to_jiffies(dev->double_click_ms);
+			return false;
+		}
+		key_tap(dev, scan, dev->keycode[scan]);
+		g->state = KEY_GS_IDLE;
+		return true;
+	}
+
+	/* 4. 长按、双击已经上报，松开不再上报 */
+	g->state = KEY_GS_IDLE;
+	return false;
+}
+
+/*
+ * @description		: 手势定时器函数：长按时间到上报长按，双击时间到上报单击
+ * @param – arg		: 手势定时器，由它得到按键设备
+ * @return			: 无
+ */
+static void key_gesture_timer_function(struct timer_list *arg)
+{
+	struct key_dev *dev = from_timer(dev, arg, gesture_timer);
+	struct key_gesture *g;
+	unsigned long flags;
+	bool sync = false;
+	int i;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	for (i = 0; i < dev->nkeys; i++) {
+		g = &dev->gestures[i];
+		if (time_before(jiffies, g->deadline))
+			continue;
+
+		if (g->state == KEY_GS_DOWN && g->long_code) {
+			key_tap(dev, i, g->long_code);
+			g->state = KEY_GS_LONG;
+			sync = true;
+		} else if (g->state == KEY_GS_UP) {
+			key_tap(dev, i, dev->keycode[i]);
+			g->state = KEY_GS_IDLE;
+			sync = true;
+		}
+	}
+
+	/* 同时到期的手势只同步一次 */
+	if (sync)
+		input_sync(dev->idev);
+	key_gesture_arm(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+/*
+ * @description		: 上报一个状态改变的按键，识别手势的按键交给手势状态机；
+ * 					  调用者持有dev->lock，并在之后同步、重新设置手势定时器
+ * @param – dev		: 按键设备
+ * @param – scan	: 扫描码
+ * @param – pressed	: 1 按下；0 松开
+ * @return			: true 上报了事件，需要同步
+ */
+static bool key_report_one(struct key_dev *dev, int scan, int pressed)
+{
+	struct key_gesture *g = &dev->gestures[scan];
+
+	if (g->long_code || g->dbl_code)
+		return key_gesture_event(dev, scan, pressed);
+
+	input_event(dev->idev, EV_MSC, MSC_SCAN, scan);
+	input_report_key(dev->idev, dev->keycode[scan], pressed);
+	return true;
+}
+
+/*
+ * @description		: 矩阵键盘：和上一次的状态比较，上报所有状态改变的按键，
+ * 					  一次扫描只产生一个SYN_REPORT
+ * @param – dev		: 按键设备
+ * @param – now		: 这一次扫描的按键状态
+ * @return			: 无
+ */
+static void key_report(struct key_dev *dev, unsigned long *now)
+{
+	DECLARE_BITMAP(changed, KEY_MAX_KEYS);
+	unsigned long flags;
+	bool sync = false;
+	int i;
+
+	bitmap_xor(changed, now, dev->state, dev->nkeys);
+	if (bitmap_empty(changed, dev->nkeys))
+		return;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	for_each_set_bit(i, changed, dev->nkeys)
+		sync |= key_report_one(dev, i, test_bit(i, now));
+	if (sync)
+		input_sync(dev->idev);
+	key_gesture_arm(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	bitmap_copy(dev->state, now, dev->nkeys);
+}
+
+/*
+ * @description		: 独立按键：key_core去抖确认一个事件之后调用，转换成input事件。
+ * 					  可能处于硬中断、软中断或中断线程上下文，不能睡眠
+ * @param – sub		: 本设备的订阅者
+ * @param – ev		: key_core的事件，code为KEY_BTN_BASE + key_core中的按键序号
+ * @return			: 无
+ */
+static void key_notify(struct key_subscriber *sub, const struct key_event *ev)
+{
+	struct key_dev *dev = container_of(sub, struct key_dev, sub);
+	unsigned int scan = ev->code - KEY_BTN_BASE;
+	unsigned long flags;
+
+	if (ev->type != KEY_EV_KEY || scan >= dev->nkeys)
+		return;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (key_report_one(dev, scan, ev->value))
+		input_sync(dev->idev);
+	key_gesture_arm(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+/*
+ * @description		: 定时器服务函数，用于矩阵键盘消抖，定时时间到了以后
+ * 					  扫描所有按键，上报状态改变的按键，最后只同步一次
+ * @param – arg		: arg参数就是定时器的结构体，由它得到按键设备
+ * @return			: 无
+ */
+static void key_timer_function(struct timer_list *arg)
+{
+	struct key_dev *dev = from_timer(dev, arg, timer);
+	DECLARE_BITMAP(now, KEY_MAX_KEYS);
+
+	/* 1. 扫描所有按键，上报状态改变的按键 */
+	key_scan(dev, now);
+	key_report(dev, now);
+
+	/* 2. mask_irq=1：先清除标志再打开中断，之后的边沿重新开始一次去抖 */
+	if (mask_irq) {
+		atomic_set(&dev->masked, 0);
+		key_irq_enable(dev, true);
+	}
+}
+
+/*
+ * @description		: 轮询函数，矩阵键盘的行没有中断时由input子系统周期调用(工作队列中)。
+ * 					  读到的状态和上一次读到的相同才上报，两次读取间隔debounce_ms，实现去抖；
+ * 					  有按键按下时按poll_min_ms扫描，空闲时扫描间隔加倍，最长poll_max_ms
+ * @param – idev	: input_dev
+ * @return			: 无
+ */
+static void key_poll(struct input_dev *idev)
+{
+	struct key_dev *dev = input_get_drvdata(idev);
+	DECLARE_BITMAP(now, KEY_MAX_KEYS);
+	int interval = input_get_poll_interval(idev);
+
+	/* 1. 扫描所有按键 */
+	key_scan(dev, now);
+
+	/* 2. 和上一次读到的不同：可能还在抖动，debounce_ms之后再读一次确认 */
+	if (!bitmap_equal(now, dev->pending, dev->nkeys)) {
+		bitmap_copy(dev->pending, now, dev->nkeys);
+		input_set_poll_interval(idev, dev->debounce_ms);
+		return;
+	}
+
+	/* 3. 两次读到的相同，上报状态改变的按键 */
+	key_report(dev, now);
+
+	/* 4. 有按键按下：快速扫描，尽快发现松开；空闲：指数退避 */
+	if (!bitmap_empty(now, dev->nkeys))
+		interval = dev->poll_min_ms;
+	else
+		interval = min_t(unsigned int, max_t(unsigned int, interval, dev->poll_min_ms) * 2,
+					dev->poll_max_ms);
+	input_set_poll_interval(idev, interval);
+}
+
+/*
+ * @description			: 从设备树中获取一组GPIO
+ * @param – nd			: device_node设备指针
+ * @param – prop		: 属性名字
+ * @param – kgs			: 返回的GPIO数组
+ * @param – name		: GPIO名字的前缀
+ * @return				: GPIO个数，失败返回负数
+ */
+static int key_parse_gpios(struct device_node *nd, const char *prop,
+			struct key_gpio *kgs, const char *name)
+{
+	int i, n;
+	enum of_gpio_flags flags;
+
+	n = of_gpio_named_count(nd, prop);
+	if (n <= 0 || n > KEY_MAX_GPIOS) {
+		printk("key:Failed to get %s\n", prop);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < n; i++) {
+		kgs[i].gpio = of_get_named_gpio_flags(nd, prop, i, &flags);
+		if (!gpio_is_valid(kgs[i].gpio)) {
+			printk("key:Failed to get %s[%d]\n", prop, i);
+			return -EINVAL;
+		}
+		kgs[i].active_low = flags & OF_GPIO_ACTIVE_LOW;
+		snprintf(kgs[i].name, sizeof(kgs[i].name), "%s%d", name, i);
+	}
+
+	return n;
+}
+
+/*
+ * @description			: 解析设备树：按键接法、GPIO和键值
+ * @param – dev			: 按键设备
  * @param – nd			: device_node设备指针
  * @return				: 成功返回0，失败返回负数
  */
-static int key_gpio_init(struct device_node *nd)
+static int key_parse_dt(struct key_dev *dev, struct device_node *nd)
 {
-	int ret;
-    unsigned long irq_flags;
-	
-	/* 从设备树中获取GPIO */
-	key.gpio_key = of_get_named_gpio(nd, "key-gpio", 0);
-	if(!gpio_is_valid(key.gpio_key)) {
-		printk("key:Failed to get key-gpio\n");
+	u32 map[KEY_MAX_KEYS];
+	int i, n;
+
+	dev->debounce_ms = KEY_DEBOUNCE_MS;
+	of_property_read_u32(nd, "debounce-delay-ms", &dev->debounce_ms);
+
+	/* 轮询间隔的范围，只在GPIO没有中断时使用 */
+	dev->poll_min_ms = KEY_POLL_MIN_MS;
+	dev->poll_max_ms = KEY_POLL_MAX_MS;
+	of_property_read_u32(nd, "poll-interval-min-ms", &dev->poll_min_ms);
+	of_property_read_u32(nd, "poll-interval-max-ms", &dev->poll_max_ms);
+	if (!dev->poll_min_ms || dev->poll_max_ms < dev->poll_min_ms) {
+		printk("key:Invalid poll-interval-min-ms/poll-interval-max-ms\n");
 		return -EINVAL;
 	}
-	
-	/* 申请使用GPIO */
-	ret = gpio_request(key.gpio_key, "KEY0");
-    if (ret) {
-        printk(KERN_ERR "key: Failed to request key-gpio\n");
-        return ret;
-	}	
-	
-	/* 将GPIO设置为输入模式 */
-    gpio_direction_input(key.gpio_key);
-	
-	/* 获取GPIO对应的中断号 */
-	key.irq_key = irq_of_parse_and_map(nd, 0);
-	if(!key.irq_key){
-        return -EINVAL;
-    }
-
-    /* 获取设备树中指定的中断触发类型 */
-	irq_flags = irq_get_trigger_type(key.irq_key);
-	if (IRQF_TRIGGER_NONE == irq_flags)
-		irq_flags = IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING;
-		
-	/* 申请中断 */
-	ret = request_irq(key.irq_key, key_interrupt, irq_flags, "Key0_IRQ", NULL);
-	if (ret) {
-        gpio_free(key.gpio_key);
-        return ret;
-    }
+
+	/* 1. 矩阵键盘：row-gpios、col-gpios、linux,keymap */
+	if (of_find_property(nd, "row-gpios", NULL)) {
+		dev->mode = KEY_MODE_MATRIX;
+		dev->nrows = key_parse_gpios(nd, "row-gpios", dev->rows, "KEYROW");
+		if (dev->nrows < 0)
+			return dev->nrows;
+		dev->ncols = key_parse_gpios(nd, "col-gpios", dev->cols, "KEYCOL");
+		if (dev->ncols < 0)
+			return dev->ncols;
+		dev->nkeys = dev->nrows * dev->ncols;
+		dev->col_delay_us = KEY_COL_DELAY_US;
+		of_property_read_u32(nd, "col-scan-delay-us", &dev->col_delay_us);
+
+		n = of_property_count_u32_elems(nd, "linux,keymap");
+		if (n <= 0 || n > KEY_MAX_KEYS ||
+			of_property_read_u32_array(nd, "linux,keymap", map, n)) {
+			printk("key:Failed to get linux,keymap\n");
+			return -EINVAL;
+		}
+		for (i = 0; i < n; i++) {
+			if (KEY_ROW(map[i]) >= dev->nrows || KEY_COL(map[i]) >= dev->ncols) {
+				printk("key:linux,keymap[%d] out of range\n", i);
+				return -EINVAL;
+			}
+			dev->keycode[KEY_ROW(map[i]) * dev->ncols + KEY_COL(map[i])] = KEY_VAL(map[i]);
+		}
+		return 0;
+	}
+
+	/* 2. 独立按键：GPIO在key_core的/key节点中(key-gpio/key-gpios)，这里只给出键值；
+	 *    只有一个按键时默认KEY_0，与原来key-gpio的写法一致 */
+	dev->mode = KEY_MODE_DIRECT;
+	dev->nkeys = key_core_nkeys();
+	if (dev->nkeys <= 0 || dev->nkeys > KEY_MAX_KEYS) {
+		printk("key:key_core has %d keys\n", dev->nkeys);
+		return -EINVAL;
+	}
+
+	n = of_property_count_u32_elems(nd, "linux,keycodes");
+	if (n > 0 && (n != dev->nkeys ||
+		of_property_read_u32_array(nd, "linux,keycodes", map, n))) {
+		printk("key:linux,keycodes must have one code per key_core key\n");
+		return -EINVAL;
+	}
+	for (i = 0; i < dev->nkeys; i++)
+		dev->keycode[i] = n > 0 ? map[i] : (dev->nkeys == 1 ? KEY_0 : BTN_0 + i);
 
 	return 0;
 }
 
 /*
- * @description		: 定时器服务函数，用于按键消抖，定时时间到了以后
- * 					  再读取按键值，根据按键的状态上报相应的事件
- * @param – arg		: arg参数就是定时器的结构体
- * @return			: 无
+ * @description			: 解析手势映射：属性由<键值 手势键值>成对组成，
+ * 						  键值为该值的所有按键都识别这个手势
+ * @param – dev			: 按键设备
+ * @param – nd			: device_node设备指针
+ * @param – prop		: 属性名字
+ * @param – dbl			: true 双击；false 长按
+ * @return				: 成功返回0，失败返回负数
  */
-static void key_timer_function(struct timer_list *arg)
+static int key_parse_gesture_map(struct key_dev *dev, struct device_node *nd,
+			const char *prop, bool dbl)
 {
-	int val;
-	
-	/* 读取按键值并上报按键事件 */
-	val = gpio_get_value(key.gpio_key);
-	input_report_key(key.idev, KEY_0, !val);
-	input_sync(key.idev);
-	enable_irq(key.irq_key);
+	u32 base, code;
+	int i, j, n;
+
+	n = of_property_count_u32_elems(nd, prop);
+	if (n <= 0)
+		return 0;
+	if (n % 2) {
+		printk("key:%s must be <code gesture-code> pairs\n", prop);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < n; i += 2) {
+		of_property_read_u32_index(nd, prop, i, &base);
+		of_property_read_u32_index(nd, prop, i + 1, &code);
+		if (!code || code > KEY_MAX) {
+			printk("key:%s: invalid code %u\n", prop, code);
+			return -EINVAL;
+		}
+		for (j = 0; j < dev->nkeys; j++) {
+			if (dev->keycode[j] != base)
+				continue;
+			if (dbl)
+				dev->gestures[j].dbl_code = code;
+			else
+				dev->gestures[j].long_code = code;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * @description			: 解析手势识别的设置：时间和映射
+ * @param – dev			: 按键设备
+ * @param – nd			: device_node设备指针
+ * @return				: 成功返回0，失败返回负数
+ */
+static int key_parse_gestures(struct key_dev *dev, struct device_node *nd)
+{
+	int ret;
+
+	dev->long_press_ms = KEY_LONG_PRESS_MS;
+	dev->double_click_ms = KEY_DOUBLE_CLICK_MS;
+	of_property_read_u32(nd, "long-press-ms", &dev->long_press_ms);
+	of_property_read_u32(nd, "double-click-ms", &dev->double_click_ms);
+
+	ret = key_parse_gesture_map(dev, nd, "linux,long-press-map", false);
+	if (ret < 0)
+		return ret;
+	return key_parse_gesture_map(dev, nd, "linux,double-click-map", true);
+}
+
+/*
+ * @description			: 释放所有的中断和GPIO，按申请的顺序倒序释放；
+ * 						  mask_irq=1时先停止定时器，它不会再打开已经释放的中断
+ * @param – dev			: 按键设备
+ * @param – nirq		: 已经申请中断的行数
+ * @param – nrow		: 已经申请GPIO的行数
+ * @param – ncol		: 已经申请GPIO的列数
+ * @return				: 无
+ */
+static void key_gpio_free(struct key_dev *dev, int nirq, int nrow, int ncol)
+{
+	int i;
+
+	/* 先屏蔽中断(等待中断服务函数返回)，之后不会再启动定时器；
+	 * 等待中的定时器打开中断后屏蔽计数仍不为0，删除它之后再释放中断 */
+	if (mask_irq && nirq > 0) {
+		for (i = 0; i < nirq; i++)
+			disable_irq(dev->rows[i].irq);
+		del_timer_sync(&dev->timer);
+	}
+
+	while (--nirq >= 0)
+		free_irq(dev->rows[nirq].irq, dev);
+	while (--nrow >= 0)
+		gpio_free(dev->rows[nrow].gpio);
+	while (--ncol >= 0)
+		gpio_free(dev->cols[ncol].gpio);
+}
+
+/*
+ * @description			: 按键初始化函数
+ * @param – dev			: 按键设备
+ * @param – nd			: device_node设备指针
+ * @return				: 成功返回0，失败返回负数
+ */
+static int key_gpio_init(struct key_dev *dev, struct device_node *nd)
+{
+	int ret, r = 0, c, i = 0;
+    unsigned long irq_flags;
+
+	/* 从设备树中获取GPIO和键值 */
+	ret = key_parse_dt(dev, nd);
+	if (ret < 0)
+		return ret;
+	ret = key_parse_gestures(dev, nd);
+	if (ret < 0)
+		return ret;
+
+	/* 独立按键的GPIO和中断由key_core管理，这里什么都不申请 */
+
+	/* 矩阵键盘的列：空闲时全部驱动 */
+	for (c = 0; c < dev->ncols; c++) {
+		ret = gpio_request(dev->cols[c].gpio, dev->cols[c].name);
+		if (ret) {
+			printk(KERN_ERR "key: Failed to request %s\n", dev->cols[c].name);
+			goto free_gpio;
+		}
+		key_col_drive(&dev->cols[c], true);
+	}
+
+	/* 申请使用GPIO，将GPIO设置为输入模式 */
+	for (r = 0; r < dev->nrows; r++) {
+		ret = gpio_request(dev->rows[r].gpio, dev->rows[r].name);
+		if (ret) {
+			printk(KERN_ERR "key: Failed to request %s\n", dev->rows[r].name);
+			goto free_gpio;
+		}
+		gpio_direction_input(dev->rows[r].gpio);
+
+		/* interrupts属性没有给出中断时，由GPIO得到中断号；
+		 * 有一个GPIO没有中断，整个设备改为轮询 */
+		if (!dev->rows[r].irq)
+			dev->rows[r].irq = gpio_to_irq(dev->rows[r].gpio);
+		if (dev->rows[r].irq <= 0)
+			dev->polled = true;
+	}
+
+	/* 申请中断，获取设备树中指定的中断触发类型 */
+	for (i = 0; i < dev->nrows && !dev->polled; i++) {
+		irq_flags = irq_get_trigger_type(dev->rows[i].irq);
+		if (IRQF_TRIGGER_NONE == irq_flags)
+			irq_flags = IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING;
+
+		ret = request_irq(dev->rows[i].irq, key_interrupt, irq_flags, dev->rows[i].name, dev);
+		if (ret)
+			goto free_gpio;
+	}
+
+	printk("key: %d keys, %s, %s\n", dev->nkeys,
+		dev->mode == KEY_MODE_MATRIX ? "matrix" : "direct",
+		dev->mode == KEY_MODE_DIRECT ? "key_core" : dev->polled ? "polled" :
+		mask_irq ? "irq, masked while debouncing" : "irq");
+	return 0;
+
+free_gpio:
+	key_gpio_free(dev, i, r, c);
+	return ret;
 }
 
 /*
@@ -119,51 +794,101 @@ static void key_timer_function(struct timer_list *arg)
  */
 static int atk_key_probe(struct platform_device *pdev)
 {
-	int ret;
-	
+	struct key_dev *dev;
+	int ret, i;
+
+	/* 每个设备树节点一个按键设备，中断、定时器、轮询都由它得到自己的状态 */
+	dev = devm_kzalloc(&pdev->dev, sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+	platform_set_drvdata(pdev, dev);
+
+	/* 初始化定时器，要在申请中断之前 */
+	timer_setup(&dev->timer, key_timer_function, 0);
+	timer_setup(&dev->gesture_timer, key_gesture_timer_function, 0);
+	spin_lock_init(&dev->lock);
+	atomic_set(&dev->masked, 0);
+
 	/* 初始化GPIO */
-	ret = key_gpio_init(pdev->dev.of_node);
+	ret = key_gpio_init(dev, pdev->dev.of_node);
 	if(ret < 0)
 		return ret;
-		
-	/* 初始化定时器 */
-	timer_setup(&key.timer, key_timer_function, 0);
-	
+
 	/* 申请input_dev */
-	key.idev = input_allocate_device();
-	key.idev->name = KEYINPUT_NAME;
-	
+	dev->idev = input_allocate_device();
+	if (!dev->idev) {
+		ret = -ENOMEM;
+		goto free_gpio;
+	}
+	dev->idev->name = KEYINPUT_NAME;
+	dev->idev->dev.parent = &pdev->dev;
+	input_set_drvdata(dev->idev, dev);
+
 #if 0
 	/* 初始化input_dev，设置产生哪些事件 */
-	__set_bit(EV_KEY, key.idev->evbit);	/* 设置产生按键事件 */
-	__set_bit(EV_REP, key.idev->evbit);	/* 重复事件，比如按下去不放开，就会一直输出信息 */
+	__set_bit(EV_KEY, dev->idev->evbit);	/* 设置产生按键事件 */
+	__set_bit(EV_REP, dev->idev->evbit);	/* 重复事件，比如按下去不放开，就会一直输出信息 */
 
 	/* 初始化input_dev，设置产生哪些按键 */
-	__set_bit(KEY_0, key.idev->keybit);	
+	__set_bit(KEY_0, dev->idev->keybit);
 #endif
 
 #if 0
-	key.idev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REP);
-	key.idev->keybit[BIT_WORD(KEY_0)] |= BIT_MASK(KEY_0);
+	dev->idev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REP);
+	dev->idev->keybit[BIT_WORD(KEY_0)] |= BIT_MASK(KEY_0);
 #endif
 
-	key.idev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REP);
-	input_set_capability(key.idev, EV_KEY, KEY_0);
+	/* 键值表：应用程序可以用EVIOCSKEYCODE重新映射，MSC_SCAN给出扫描码 */
+	dev->idev->keycode = dev->keycode;
+	dev->idev->keycodesize = sizeof(dev->keycode[0]);
+	dev->idev->keycodemax = dev->nkeys;
+
+	/* 没有中断：由input子系统在设备打开期间周期调用key_poll()，间隔在key_poll()中调整 */
+	if (dev->polled) {
+		ret = input_setup_polling(dev->idev, key_poll);
+		if (ret)
+			goto free_gpio;
+		input_set_poll_interval(dev->idev, dev->poll_min_ms);
+		input_set_min_poll_interval(dev->idev, dev->poll_min_ms);
+		input_set_max_poll_interval(dev->idev, dev->poll_max_ms);
+	}
+
+	dev->idev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REP);
+	input_set_capability(dev->idev, EV_MSC, MSC_SCAN);
+	for (i = 0; i < dev->nkeys; i++) {
+		if (dev->keycode[i] != KEY_RESERVED)
+			input_set_capability(dev->idev, EV_KEY, dev->keycode[i]);
+		if (dev->gestures[i].long_code)
+			input_set_capability(dev->idev, EV_KEY, dev->gestures[i].long_code);
+		if (dev->gestures[i].dbl_code)
+			input_set_capability(dev->idev, EV_KEY, dev->gestures[i].dbl_code);
+	}
 
 	/* 注册输入设备 */
-	ret = input_register_device(key.idev);
+	ret = input_register_device(dev->idev);
 	if (ret) {
 		printk("register input device failed!\r\n");
 		goto free_gpio;
 	}
-	
+
+	/* 独立按键：input_dev注册之后再订阅key_core的事件 */
+	if (dev->mode == KEY_MODE_DIRECT) {
+		dev->sub.notify = key_notify;
+		ret = key_core_subscribe(&dev->sub);
+		if (ret) {
+			input_unregister_device(dev->idev);	/* 同时释放input_dev */
+			return ret;
+		}
+	}
+
 	return 0;
 free_gpio:
-	free_irq(key.irq_key,NULL);
-	gpio_free(key.gpio_key);
-	del_timer_sync(&key.timer);
-	return -EIO;
-	
+	key_gpio_free(dev, dev->polled ? 0 : dev->nrows, dev->nrows, dev->ncols);
+	del_timer_sync(&dev->timer);
+	del_timer_sync(&dev->gesture_timer);
+	input_free_device(dev->idev);	/* 中断和定时器都停止之后再释放，为NULL时什么都不做 */
+	return ret;
+
 }
 
 /*
@@ -174,11 +899,18 @@ free_gpio:
  */
 static int atk_key_remove(struct platform_device *pdev)
 {
-	free_irq(key.irq_key,NULL);			/* 释放中断号 */
-	gpio_free(key.gpio_key);			/* 释放GPIO */
-	del_timer_sync(&key.timer);			/* 删除timer */
-	input_unregister_device(key.idev);	/* 释放input_dev */
-	
+	struct key_dev *dev = platform_get_drvdata(pdev);
+
+	if (dev->mode == KEY_MODE_DIRECT)
+		key_core_unsubscribe(&dev->sub);	/* 返回之后key_notify()不会再被调用 */
+	key_gpio_free(dev, dev->polled ? 0 : dev->nrows, 0, 0);	/* 释放中断号 */
+	del_timer_sync(&dev->timer);			/* 删除timer */
+	input_get_device(dev->idev);		/* 手势定时器可能还会上报，先保留input_dev */
+	input_unregister_device(dev->idev);	/* 注销input_dev，同时停止轮询 */
+	del_timer_sync(&dev->gesture_timer);	/* 不会再有扫描启动手势定时器 */
+	input_put_device(dev->idev);		/* 释放input_dev */
+	key_gpio_free(dev, 0, dev->nrows, dev->ncols);	/* 释放GPIO */
+
 	return 0;
 }
 
@@ -200,4 +932,4 @@ module_platform_driver(atk_key_driver);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("ALIENTEK");
-MODULE_INFO(intree, "Y");
\ No newline at end of file
+MODULE_INFO(intree, "Y");
@@ -5,6 +5,7 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 版本	   	: V1.0
 描述	   	: input子系统测试APP。
 其他	   	: linux 使用结构体struct input_event ev, 表示输入事件;
+			  驱动每次扫描只同步一次，SYN_REPORT时打印这一次扫描改变了几个按键
 使用方法	 ：./keyinputApp /dev/input/event1
 ***************************************************************/
 #include <stdio.h>
@@ -25,6 +26,7 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 int main(int argc, char *argv[])
 {
     int fd, ret;
+    int nkeys = 0;          // 两次SYN_REPORT之间改变的按键个数
     struct input_event ev;  // linux 使用结构体struct input_event ev, 表示输入事件;
     // 注册input_event成功之后，会在/dev/input/目录下自动生成/dev/input/eventX文件，读取文件就会读到输入事件信息
 
@@ -49,11 +51,21 @@ int main(int argc, char *argv[])
         if (ret) {
             switch (ev.type) {
             case EV_KEY:				// 按键事件, Event types, 定义了不同的宏
+                nkeys++;
                 if (KEY_0 == ev.code) {		// 判断是不是KEY_0按键
                     if (ev.value)			// 按键按下
                         printf("Key0 Press\n");
                     else					// 按键松开
                         printf("Key0 Release\n");
+                } else if (2 != ev.value) {	// 其他按键，2为重复事件不打印
+                    printf("Key %d %s\n", ev.code, ev.value ? "Press" : "Release");
+                }
+                break;
+
+            case EV_SYN:				// 一次扫描结束
+                if (SYN_REPORT == ev.code && nkeys) {
+                    printf("SYN_REPORT: %d key(s)\n", nkeys);
+                    nkeys = 0;
                 }
                 break;
 
@@ -0,0 +1,244 @@
+/***************************************************************
+文件名              : keystormApp.c
+作者                : 正点原子Linux团队
+版本                : V1.0
+描述                : 边沿风暴测试：一个GPIO输出代替按键，产生带抖动的按下、松开，
+                      同时从/dev/input/eventX统计上报的按下、松开，得到丢失和多出的次数
+其他                : 接线：输出GPIO用杜邦线接到矩阵键盘的行(设备树keyinput-storm节点)，
+                      行为低电平有效，输出0为按下、1为松开；不需要gpio-sim；
+                      用GPIO字符设备的v1接口(GPIO_GET_LINEHANDLE_IOCTL)翻转输出，
+                      翻转在单独的线程中，主线程poll读取input事件；
+                      对比两种去抖方式：insmod keyinput.ko 和 insmod keyinput.ko mask_irq=1
+使用方法            : ./keystormApp /dev/input/eventX /dev/gpiochipN line [count] [bounces] [hold_ms]
+                      line    : 输出GPIO在gpiochip中的序号
+                      count   : 按下、松开的次数，默认100
+                      bounces : 每次按下、松开之前的抖动边沿数，默认8，间隔BOUNCE_US
+                      hold_ms : 抖动之后保持稳定的时间，要大于驱动的去抖时间，默认50
+***************************************************************/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <linux/input.h>
+#include <linux/gpio.h>
+
+#define DEFAULT_COUNT 100   /* 默认按下、松开的次数 */
+#define DEFAULT_BOUNCES 8   /* 默认每次按下、松开之前的抖动边沿数 */
+#define DEFAULT_HOLD_MS 50  /* 默认抖动之后保持稳定的时间 */
+#define BOUNCE_US 300       /* 两个抖动边沿的间隔 */
+#define DRAIN_MS 500        /* 翻转结束之后继续等待事件的时间 */
+
+/* 翻转线程的参数 */
+struct storm {
+    int line_fd;            /* GPIO_GET_LINEHANDLE_IOCTL得到的输出GPIO */
+    int count;              /* 按下、松开的次数 */
+    int bounces;            /* 每次按下、松开之前的抖动边沿数 */
+    int hold_ms;            /* 抖动之后保持稳定的时间 */
+    volatile int done;      /* 翻转线程已经结束 */
+};
+
+/*
+ * @description     : 设置输出GPIO的电平
+ * @param - fd      : 输出GPIO
+ * @param - value   : 电平，0 按下；1 松开
+ * @return          : 0 成功；其他 失败
+ */
+static int line_set(int fd, int value)
+{
+    struct gpiohandle_data data;
+
+    memset(&data, 0, sizeof(data));
+    data.values[0] = value;
+    return ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+}
+
+/*
+ * @description     : 先产生bounces个抖动边沿，最后停在value并保持hold_ms
+ * @param - s       : 翻转参数
+ * @param - value   : 最后稳定的电平
+ * @return          : 0 成功；其他 失败
+ */
+static int line_bounce(struct storm *s, int value)
+{
+    int i;
+
+    for (i = 0; i < s->bounces; i++) {
+        /* 偶数个边沿之后回到原来的电平，最后一次翻转到value */
+        if (line_set(s->line_fd, (i & 1) ? !value : value))
+            return -1;
+        usleep(BOUNCE_US);
+    }
+    if (line_set(s->line_fd, value))
+        return -1;
+    usleep(s->hold_ms * 1000);
+    return 0;
+}
+
+/*
+ * @description     : 翻转线程：count次带抖动的按下、松开
+ * @param - arg     : 翻转参数
+ * @return          : NULL
+ */
+static void *storm_thread(void *arg)
+{
+    struct storm *s = arg;
+    int i;
+
+    for (i = 0; i < s->count; i++) {
+        if (line_bounce(s, 0) || line_bounce(s, 1)) {
+            perror("GPIOHANDLE_SET_LINE_VALUES_IOCTL");
+            s->count = i;   /* 只统计已经完成的次数 */
+            break;
+        }
+    }
+    s->done = 1;
+    return NULL;
+}
+
+/*
+ * @description     : 申请输出GPIO，初始为松开(1)
+ * @param - chip    : /dev/gpiochipN
+ * @param - line    : GPIO在gpiochip中的序号
+ * @return          : 输出GPIO的文件描述符；负值 失败
+ */
+static int line_request(const char *chip, int line)
+{
+    struct gpiohandle_request req;
+    int fd, ret;
+
+    fd = open(chip, O_RDONLY);
+    if (0 > fd) {
+        printf("Error: file %s open failed!\r\n", chip);
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = line;
+    req.lines = 1;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    req.default_values[0] = 1;
+    strcpy(req.consumer_label, "keystorm");
+    ret = ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req);
+    close(fd);
+    if (0 > ret) {
+        perror("GPIO_GET_LINEHANDLE_IOCTL");
+        return -1;
+    }
+    return req.fd;
+}
+
+/*
+ * @description         : main主程序
+ * @param – argc         : argv数组元素个数
+ * @param – argv         : 具体参数
+ * @return              : 0 成功;其他 失败
+ */
+int main(int argc, char *argv[])
+{
+    struct storm s;
+    struct input_event ev[16];
+    struct pollfd pfd;
+    pthread_t tid;
+    int fd, ret, i, n;
+    int presses = 0, releases = 0;  /* 收到的按下、松开 */
+    int doubled = 0;                /* 没有松开又收到按下，或者没有按下又收到松开 */
+    int down = 0;                   /* 上一次收到的是按下 */
+    int idle_ms = 0;                /* 翻转结束之后已经等待的时间 */
+
+    if (4 > argc || 7 < argc) {
+        printf("Usage:\n"
+             "\t./keystormApp /dev/input/eventX /dev/gpiochipN line [count] [bounces] [hold_ms]\n"
+        );
+        return -1;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.count = 5 > argc ? DEFAULT_COUNT : atoi(argv[4]);
+    s.bounces = 6 > argc ? DEFAULT_BOUNCES : atoi(argv[5]);
+    s.hold_ms = 7 > argc ? DEFAULT_HOLD_MS : atoi(argv[6]);
+    if (0 >= s.count || 0 > s.bounces || 0 >= s.hold_ms) {
+        printf("Error: bad count/bounces/hold_ms\r\n");
+        return -1;
+    }
+
+    /* 1. 打开input设备，申请输出GPIO，先保持松开等驱动稳定 */
+    fd = open(argv[1], O_RDONLY | O_NONBLOCK);
+    if (0 > fd) {
+        printf("Error: file %s open failed!\r\n", argv[1]);
+        return -1;
+    }
+    s.line_fd = line_request(argv[2], atoi(argv[3]));
+    if (0 > s.line_fd) {
+        close(fd);
+        return -1;
+    }
+    usleep(s.hold_ms * 1000);
+    while (0 < read(fd, ev, sizeof(ev)))
+        ;   /* 丢弃之前的事件 */
+
+    /* 2. 启动翻转线程 */
+    ret = pthread_create(&tid, NULL, storm_thread, &s);
+    if (ret) {
+        printf("Error: pthread_create failed %d\r\n", ret);
+        ret = -1;
+        goto out;
+    }
+
+    /* 3. 统计按下、松开，忽略重复事件(value 2)；
+     *    翻转结束之后DRAIN_MS内没有新事件就停止 */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!s.done || idle_ms < DRAIN_MS) {
+        ret = poll(&pfd, 1, 10);
+        if (0 > ret) {
+            perror("poll");
+            break;
+        }
+        if (0 == ret) {
+            if (s.done)
+                idle_ms += 10;
+            continue;
+        }
+        idle_ms = 0;
+
+        n = read(fd, ev, sizeof(ev));
+        for (i = 0; i < n / (int)sizeof(ev[0]); i++) {
+            if (EV_KEY != ev[i].type || 2 == ev[i].value)
+                continue;
+            if (ev[i].value) {
+                presses++;
+                doubled += down;
+                down = 1;
+            } else {
+                releases++;
+                doubled += !down;
+                down = 0;
+            }
+        }
+    }
+    pthread_join(tid, NULL);
+    ret = 0;
+
+    /* 4. 打印结果：少于翻转次数为丢失，多于翻转次数为多出 */
+    printf("sent     : %d press/release, %d bounces each, hold %d ms\n",
+           s.count, s.bounces, s.hold_ms);
+    printf("press    : %d, lost %d, spurious %d\n", presses,
+           presses < s.count ? s.count - presses : 0,
+           presses > s.count ? presses - s.count : 0);
+    printf("release  : %d, lost %d, spurious %d\n", releases,
+           releases < s.count ? s.count - releases : 0,
+           releases > s.count ? releases - s.count : 0);
+    printf("unpaired : %d\n", doubled);
+
+out:
+    close(s.line_fd);
+    close(fd);
+    return ret;
+}
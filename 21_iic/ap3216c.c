@@ -19,113 +19,172 @@
 #include <linux/semaphore.h>
 #include <linux/timer.h>
 #include <linux/i2c.h>
+#include <linux/regmap.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/interrupt.h>
+#include <linux/pm_runtime.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include "ap3216creg.h"
 
-#define AP3216C_CNT	1
+#define CREATE_TRACE_POINTS
+#include "ap3216c_trace.h"
+
+#define AP3216C_CNT	8		/* 设备号个数，即最多支持的AP3216C数量 */
 #define AP3216C_NAME	"ap3216c"
+#define AP3216C_DATA_LEN	6	/* IRDATALOW~PSDATAHIGH 共6个数据寄存器 */
+#define AP3216C_RING_SIZE	64	/* 采样环形缓冲区的记录数，必须是2的幂 */
+#define AP3216C_READ_BATCH	16	/* read()每次从环形缓冲区批量拷贝的记录数 */
+#define AP3216C_MIN_PERIOD_MS	113	/* ALS+PS+IR同时打开时两次读取间隔要大于112.5ms */
+#define AP3216C_RESET_MS	10	/* AP3216C复位最少10ms */
+
+/* ALS计数换算成mlux：每个计数对应的mlux左移AP3216C_LUX_SHIFT位，
+ * 除法在编译时完成，读路径上只有一次乘法和移位 */
+#define AP3216C_LUX_SHIFT	16
+#define AP3216C_MLUX_FIX(mlux_x10)	(((mlux_x10) << AP3216C_LUX_SHIFT) / 10)
+static const u32 ap3216c_mlux_lut[] = {
+	AP3216C_MLUX_FIX(3600),		/* 0: 20661lux，0.36lux/计数   */
+	AP3216C_MLUX_FIX(890),		/* 1: 5162lux， 0.089lux/计数  */
+	AP3216C_MLUX_FIX(220),		/* 2: 1291lux， 0.022lux/计数  */
+	AP3216C_MLUX_FIX(56),		/* 3: 323lux，  0.0056lux/计数 */
+};
+
+/* 所有AP3216C共用一个类和一段设备号，模块加载时申请，每个设备从中分配一个次设备号 */
+static struct class *ap3216c_class;	/* 类 		*/
+static dev_t ap3216c_devt;			/* 起始设备号 */
+static DEFINE_IDR(ap3216c_idr);		/* 次设备号分配器，同时由次设备号查找设备 */
+static DEFINE_MUTEX(ap3216c_idr_lock);	/* 保护ap3216c_idr，open与remove互斥 */
+
+/* 采样周期，单位ms，小于AP3216C_MIN_PERIOD_MS时按AP3216C_MIN_PERIOD_MS处理 */
+static unsigned int sample_ms = 120;
+module_param(sample_ms, uint, 0644);
+MODULE_PARM_DESC(sample_ms, "sampling period in ms (min 113)");
+
+/* 空闲多久后进入掉电模式，单位ms，运行时也可以通过power/autosuspend_delay_ms修改 */
+static int autosuspend_ms = 2000;
+module_param(autosuspend_ms, int, 0444);
+MODULE_PARM_DESC(autosuspend_ms, "default runtime PM autosuspend delay in ms");
+
+/* 环形缓冲区里的记录：额外保存采样时的ALS量程，换算lux时使用 */
+struct ap3216c_record {
+	struct ap3216c_sample s;
+	u8 als_range;
+};
 
 struct ap3216c_dev {
 	struct i2c_client *client;	/* i2c 设备 ******************/
 	dev_t devid;			/* 设备号 	 */
-	struct cdev cdev;		/* cdev 	*/
-	struct class *class;	/* 类 		*/
+	int minor;				/* 次设备号，由ap3216c_idr分配 */
+	struct cdev *cdev;		/* cdev，cdev_alloc()分配，最后一个打开者关闭后由内核释放 */
+	struct kref ref;		/* probe和每个打开的文件各持有一个引用，最后一个释放时kfree */
+	bool removed;			/* remove已执行，不再访问总线，由lock保护 */
 	struct device *device;	/* 设备 	 */
 	struct device_node	*nd; /* 设备节点 */
 	unsigned short ir, als, ps;		/* 三个光传感器数据 */
+	struct regmap *regmap;			/* 寄存器访问，配置寄存器带缓存 */
+
+	/* 采样线程与环形缓冲区：采样线程是唯一的生产者，每个打开的文件是一个消费者 */
+	struct ap3216c_record ring[AP3216C_RING_SIZE];	/* 带时间戳的采样记录 */
+	unsigned long head;				/* 已写入的记录总数，只由采样线程修改 */
+	struct task_struct *sampler;	/* 采样线程 */
+	wait_queue_head_t r_wait;		/* 读等待队列头，有新记录时唤醒 */
+	struct mutex lock;				/* 保护users、ready和采样线程的启停 */
+	int users;						/* 打开的文件数 */
+	bool ready;						/* 芯片已复位并使能ALS+PS+IR，probe中置位 */
+	struct mutex bus_lock;			/* 串行化总线访问与ir/als/ps，采样线程和IIO共用 */
+
+	/* 中断模式：设备树给出了INT引脚时不再周期采样，只在数据超出阈值时产生记录 */
+	int irq;						/* INT引脚对应的中断号，0表示没有 */
+	struct ap3216c_thresh als_thresh;	/* ALS阈值，芯片复位后重新写入 */
+	struct ap3216c_thresh ps_thresh;	/* PS阈值，芯片复位后重新写入 */
+	struct ap3216c_config cfg;		/* 量程、增益和积分时间，由bus_lock保护 */
+
+	/* 运行时电源管理统计，配合power/runtime_active_time等计算工作与空闲时间 */
+	atomic_t suspend_count;			/* 进入掉电模式的次数 */
+	atomic_t resume_count;			/* 恢复工作模式的次数 */
+
+	/* IIO接口：与字符设备并存，通过/dev/iio:deviceX批量读取 */
+	struct iio_dev *indio_dev;
+	struct {
+		u16 channels[3];			/* 按使能的通道紧凑排列 */
+		s64 timestamp __aligned(8);	/* 触发时刻的时间戳 */
+	} scan;
+};
+
+/* 每个打开的文件各自保存读位置，互不影响 */
+struct ap3216c_file {
+	struct ap3216c_dev *dev;
+	unsigned long tail;				/* 下一条要读取的记录序号 */
+	unsigned int format;			/* read()返回的记录格式AP3216C_FMT_xxx */
+	struct mutex lock;				/* 同一个文件被多个线程同时read时保护tail和下面的缓冲区 */
+
+	/* read()的批量拷贝缓冲区，约800字节，放在栈上会接近ARM的FRAME_WARN(1024)，随文件一起分配 */
+	struct ap3216c_record batch[AP3216C_READ_BATCH];
+	union {
+		struct ap3216c_sample raw[AP3216C_READ_BATCH];
+		struct ap3216c_lux_sample lux[AP3216C_READ_BATCH];
+	} out;
 };
 
 /*
- * @description	: 从ap3216c读取多个寄存器数据
- * @param - dev:  ap3216c设备
- * @param - reg:  要读取的寄存器首地址
- * @param - val:  读取到的数据
- * @param - len:  要读取的数据长度
- * @return 		: 操作结果
+ * @description	: 易失寄存器：数据和中断状态由芯片更新，每次都要访问总线，不缓存
+ * @param - dev	: 未使用
+ * @param - reg	: 寄存器地址
+ * @return 		: true 易失
  */
-static int ap3216c_read_regs(struct ap3216c_dev *dev, u8 reg, void *val, int len)
+static bool ap3216c_volatile_reg(struct device *dev, unsigned int reg)
 {
-	int ret;
-	struct i2c_msg msg[2];
-	struct i2c_client *client = (struct i2c_client *)dev->client;
-
-	/* msg[0]为发送要读取的首地址 */
-	msg[0].addr = client->addr;			/* ap3216c地址 */
-	msg[0].flags = 0;					/* 标记为发送数据 */
-	msg[0].buf = &reg;					/* 读取的首地址 */
-	msg[0].len = 1;						/* reg长度*/
-
-	/* msg[1]读取数据 */
-	msg[1].addr = client->addr;			/* ap3216c地址 */
-	msg[1].flags = I2C_M_RD;			/* 标记为读取数据*/
-	msg[1].buf = val;					/* 读取数据缓冲区 */
-	msg[1].len = len;					/* 要读取的数据长度*/
-
-	ret = i2c_transfer(client->adapter, msg, 2);
-	if(ret == 2) {
-		ret = 0;
-	} else {
-		printk("i2c rd failed=%d reg=%06x len=%d\n",ret, reg, len);
-		ret = -EREMOTEIO;
+	switch (reg) {
+	case AP3216C_INTSTATUS:
+	case AP3216C_IRDATALOW ... AP3216C_PSDATAHIGH:
+		return true;
+	default:
+		return false;
 	}
-	return ret;
 }
 
 /*
- * @description	: 向ap3216c多个寄存器写入数据
- * @param - dev:  ap3216c设备
- * @param - reg:  要写入的寄存器首地址
- * @param - val:  要写入的数据缓冲区
- * @param - len:  要写入的数据长度
- * @return 	  :   操作结果
+ * @description	: 可写寄存器：数据寄存器只读
+ * @param - dev	: 未使用
+ * @param - reg	: 寄存器地址
+ * @return 		: true 可写
  */
-static s32 ap3216c_write_regs(struct ap3216c_dev *dev, u8 reg, u8 *buf, u8 len)
+static bool ap3216c_writeable_reg(struct device *dev, unsigned int reg)
 {
-	// u8 代表一个8位的unsigned char;
-	u8 b[256];
-	struct i2c_msg msg;
-	struct i2c_client *client = (struct i2c_client *)dev->client;
-	
-	b[0] = reg;					/* 寄存器首地址 */
-	memcpy(&b[1],buf,len);		/* 将要写入的数据拷贝到数组b里面 */
-		
-	msg.addr = client->addr;	/* ap3216c地址 */
-	msg.flags = 0;				/* 标记为写数据 */
-
-	msg.buf = b;				/* 要写入的数据缓冲区 */
-	msg.len = len + 1;			/* 要写入的数据长度 */
-
-	return i2c_transfer(client->adapter, &msg, 1);
+	return reg < AP3216C_IRDATALOW || reg > AP3216C_PSDATAHIGH;
 }
 
-/*
- * @description	: 读取ap3216c指定寄存器值，读取一个寄存器
- * @param - dev:  ap3216c设备
- * @param - reg:  要读取的寄存器
- * @return 	  :   读取到的寄存器值
- */
-static unsigned char ap3216c_read_reg(struct ap3216c_dev *dev, u8 reg)
-{
-	u8 data = 0;
-
-	ap3216c_read_regs(dev, reg, &data, 1);
-	return data;
-}
+/* regmap配置：8位地址、8位数据，配置寄存器用rbtree缓存，
+ * regmap_update_bits()写入的值与缓存相同时不访问总线 */
+static const struct regmap_config ap3216c_regmap_config = {
+	.reg_bits = 8,
+	.val_bits = 8,
+	.max_register = AP3216C_PSTHRESHH,
+	.volatile_reg = ap3216c_volatile_reg,
+	.writeable_reg = ap3216c_writeable_reg,
+	.cache_type = REGCACHE_RBTREE,
+};
 
 /*
- * @description	: 向ap3216c指定寄存器写入指定的值，写一个寄存器
+ * @description	: 向ap3216c配置寄存器写入指定的值，与缓存相同时跳过
  * @param - dev:  ap3216c设备
  * @param - reg:  要写的寄存器
  * @param - data: 要写入的值
- * @return   :    无
+ * @return   :    0 成功;其他 失败
  */
-static void ap3216c_write_reg(struct ap3216c_dev *dev, u8 reg, u8 data)
+static int ap3216c_write_reg(struct ap3216c_dev *dev, u8 reg, u8 data)
 {
-	u8 buf = 0;
-	buf = data;
-	ap3216c_write_regs(dev, reg, &buf, 1);
+	return regmap_update_bits(dev->regmap, reg, 0xFF, data);
 }
 
 /*
@@ -134,17 +193,18 @@ static void ap3216c_write_reg(struct ap3216c_dev *dev, u8 reg, u8 data)
  * @param - ir	: ir数据
  * @param - ps 	: ps数据
  * @param - ps 	: als数据 
- * @return 		: 无。
+ * @return 		: 0 成功;其他 失败
  */
-void ap3216c_readdata(struct ap3216c_dev *dev)
+static int ap3216c_readdata(struct ap3216c_dev *dev)
 {
-	unsigned char i =0;
-    unsigned char buf[6];
+	int ret;
+    unsigned char buf[AP3216C_DATA_LEN];
 	
-	/* 循环读取所有传感器数据，一共6个寄存器 */
-    for(i = 0; i < 6; i++) {
-        buf[i] = ap3216c_read_reg(dev, AP3216C_IRDATALOW + i);	
-    }
+	/* 一次突发读取所有传感器数据，一共6个寄存器；
+	 * regmap-i2c按适配器能力选择I2C组合传输、SMBus块读或逐字节读 */
+	ret = regmap_bulk_read(dev->regmap, AP3216C_IRDATALOW, buf, AP3216C_DATA_LEN);
+	if (ret < 0)
+		return ret;
 
     if(buf[0] & 0X80) 	/* IR_OF位为1,则数据无效 */
 		dev->ir = 0;					
@@ -157,6 +217,306 @@ void ap3216c_readdata(struct ap3216c_dev *dev)
 		dev->ps = 0;    													
 	else /* 读取PS传感器的数据：buf[4]取最低4位（& 0X0F）与buf[5]取最低6位（& 0X3F）并左移4位之后取或（追加），一共10位    */
 		dev->ps = ((unsigned short)(buf[5] & 0X3F) << 4) | (buf[4] & 0X0F); 
+
+	return 0;
+}
+
+/*
+ * @description	: 采样线程向环形缓冲区写入一条记录(单生产者，无锁)
+ * 				  先写记录内容，再用release语义发布head，读者用acquire语义读取head；
+ * 				  写入前的smp_wmb()保证上一次发布的head先于本次覆盖旧记录被读者看到。
+ * @param - dev	: ap3216c设备，调用者持有dev->bus_lock
+ * @param - flags: 0 周期采样;否则为触发中断的AP3216C_INT_xxx位
+ * @return 		: 无
+ */
+static void ap3216c_ring_put(struct ap3216c_dev *dev, unsigned short flags)
+{
+	struct ap3216c_record *r = &dev->ring[dev->head & (AP3216C_RING_SIZE - 1)];
+
+	smp_wmb();
+	r->s.timestamp = ktime_get_ns();
+	r->s.ir = dev->ir;
+	r->s.als = dev->als;
+	r->s.ps = dev->ps;
+	r->s.flags = flags;
+	r->als_range = dev->cfg.als_range;
+	smp_store_release(&dev->head, dev->head + 1);
+}
+
+/*
+ * @description	: 判断从tail开始是否有未读的记录
+ * @param - dev	: ap3216c设备
+ * @param - tail: 读位置
+ * @return 		: true 有未读记录
+ */
+static bool ap3216c_ring_avail(struct ap3216c_dev *dev, unsigned long tail)
+{
+	return smp_load_acquire(&dev->head) != tail;
+}
+
+/*
+ * @description	: 从环形缓冲区读取最多n条记录(多消费者，无锁)
+ * 				  读者落后超过AP3216C_RING_SIZE时丢弃已被覆盖的旧记录；
+ * 				  拷贝后重新检查head，若拷贝期间记录被采样线程覆盖则重读。
+ * @param - dev	: ap3216c设备
+ * @param - tail: 读位置，读取后向后移动
+ * @param - out	: 读取到的记录
+ * @param - n	: 最多读取的记录数
+ * @return 		: 实际读取的记录数
+ */
+static size_t ap3216c_ring_get(struct ap3216c_dev *dev, unsigned long *tail,
+							   struct ap3216c_record *out, size_t n)
+{
+	unsigned long head, t;
+	size_t i, cnt;
+
+retry:
+	head = smp_load_acquire(&dev->head);
+	t = *tail;
+	if (head - t > AP3216C_RING_SIZE - 1)		/* 读得太慢，跳过被覆盖的记录 */
+		t = head - (AP3216C_RING_SIZE - 1);
+
+	cnt = min_t(size_t, head - t, n);
+	for (i = 0; i < cnt; i++)
+		out[i] = dev->ring[(t + i) & (AP3216C_RING_SIZE - 1)];
+
+	/* head到达t+AP3216C_RING_SIZE时采样线程才会开始覆盖第t条记录 */
+	smp_rmb();
+	if (READ_ONCE(dev->head) - t > AP3216C_RING_SIZE - 1)
+		goto retry;
+
+	*tail = t + cnt;
+	return cnt;
+}
+
+/*
+ * @description	: 访问芯片之前增加运行时PM引用计数，芯片处于掉电模式时先恢复
+ * @param - dev	: ap3216c设备
+ * @return 		: 0 成功;其他 失败
+ */
+static int ap3216c_pm_get(struct ap3216c_dev *dev)
+{
+	int ret;
+
+	ret = pm_runtime_get_sync(&dev->client->dev);
+	if (ret < 0) {
+		pm_runtime_put_noidle(&dev->client->dev);
+		return ret;
+	}
+	return 0;
+}
+
+/*
+ * @description	: 访问结束，减少引用计数，空闲autosuspend_delay_ms后自动掉电
+ * @param - dev	: ap3216c设备
+ * @return 		: 无
+ */
+static void ap3216c_pm_put(struct ap3216c_dev *dev)
+{
+	pm_runtime_mark_last_busy(&dev->client->dev);
+	pm_runtime_put_autosuspend(&dev->client->dev);
+}
+
+/*
+ * @description	: 采样线程：周期读取传感器数据并写入环形缓冲区，
+ * 				  read()不再访问I2C总线
+ * @param - data: ap3216c设备
+ * @return 		: 0
+ */
+static int ap3216c_sampler_thread(void *data)
+{
+	struct ap3216c_dev *dev = data;
+	int ret;
+
+	while (!kthread_should_stop()) {
+		/* 先等待一个转换周期再读，保证使能后的第一条数据有效 */
+		schedule_timeout_interruptible(msecs_to_jiffies(max_t(unsigned int, sample_ms,
+														  AP3216C_MIN_PERIOD_MS)));
+		if (kthread_should_stop())
+			break;
+
+		/* 采样周期小于自动掉电延时，采样期间芯片一直处于工作模式 */
+		if (ap3216c_pm_get(dev) < 0)
+			continue;
+
+		mutex_lock(&dev->bus_lock);
+		ret = ap3216c_readdata(dev);
+		if (!ret)
+			ap3216c_ring_put(dev, 0);
+		mutex_unlock(&dev->bus_lock);
+		ap3216c_pm_put(dev);
+
+		if (!ret)
+			wake_up_interruptible(&dev->r_wait);
+	}
+	return 0;
+}
+
+/*
+ * @description	: INT引脚的中断线程：读取并清除中断状态，记录一次越过阈值时的数据，
+ * 				  只有这时才唤醒读者，光照稳定时既没有总线访问也没有唤醒
+ * @param - irq	: 中断号
+ * @param - dev_id: ap3216c设备
+ * @return 		: 中断执行结果
+ */
+static irqreturn_t ap3216c_irq_thread(int irq, void *dev_id)
+{
+	struct ap3216c_dev *dev = dev_id;
+	unsigned int status;
+
+	mutex_lock(&dev->bus_lock);
+	if (regmap_read(dev->regmap, AP3216C_INTSTATUS, &status) < 0 ||
+		!(status & (AP3216C_INT_ALS | AP3216C_INT_PS))) {
+		mutex_unlock(&dev->bus_lock);
+		return IRQ_NONE;
+	}
+	status &= AP3216C_INT_ALS | AP3216C_INT_PS;
+
+	if (ap3216c_readdata(dev) == 0)
+		ap3216c_ring_put(dev, status);
+
+	/* 写1清除中断标志，INT引脚恢复高电平 */
+	regmap_write(dev->regmap, AP3216C_INTSTATUS, status);
+	mutex_unlock(&dev->bus_lock);
+
+	wake_up_interruptible(&dev->r_wait);
+	return IRQ_HANDLED;
+}
+
+/*
+ * @description	: 把ALS、PS阈值写入芯片，没有变化的寄存器不访问总线
+ * @param - dev	: ap3216c设备，调用者持有dev->bus_lock
+ * @return 		: 无
+ */
+static void ap3216c_write_thresh(struct ap3216c_dev *dev)
+{
+	ap3216c_write_reg(dev, AP3216C_ALSTHRESLL, dev->als_thresh.low & 0xFF);
+	ap3216c_write_reg(dev, AP3216C_ALSTHRESLH, dev->als_thresh.low >> 8);
+	ap3216c_write_reg(dev, AP3216C_ALSTHRESHL, dev->als_thresh.high & 0xFF);
+	ap3216c_write_reg(dev, AP3216C_ALSTHRESHH, dev->als_thresh.high >> 8);
+
+	/* PS阈值10位：低字节寄存器放bit[1:0]，高字节寄存器放bit[9:2] */
+	ap3216c_write_reg(dev, AP3216C_PSTHRESLL, dev->ps_thresh.low & 0x03);
+	ap3216c_write_reg(dev, AP3216C_PSTHRESLH, dev->ps_thresh.low >> 2);
+	ap3216c_write_reg(dev, AP3216C_PSTHRESHL, dev->ps_thresh.high & 0x03);
+	ap3216c_write_reg(dev, AP3216C_PSTHRESHH, dev->ps_thresh.high >> 2);
+}
+
+/*
+ * @description	: 把量程、增益和积分时间写入芯片，只修改对应的位，没有变化时不访问总线
+ * @param - dev	: ap3216c设备，调用者持有dev->bus_lock
+ * @return 		: 0 成功;其他 失败
+ */
+static int ap3216c_write_config(struct ap3216c_dev *dev)
+{
+	int ret;
+
+	ret = regmap_update_bits(dev->regmap, AP3216C_ALSCONFIG, AP3216C_ALS_RANGE_MASK,
+							 dev->cfg.als_range << AP3216C_ALS_RANGE_SHIFT);
+	if (ret)
+		return ret;
+	ret = regmap_update_bits(dev->regmap, AP3216C_PSCONFIG,
+							 AP3216C_PS_INTEG_MASK | AP3216C_PS_GAIN_MASK,
+							 (dev->cfg.ps_integ << AP3216C_PS_INTEG_SHIFT) |
+							 (dev->cfg.ps_gain << AP3216C_PS_GAIN_SHIFT));
+	if (ret)
+		return ret;
+	return regmap_update_bits(dev->regmap, AP3216C_PSMEANTIME, AP3216C_PS_MEAN_MASK,
+							  dev->cfg.ps_mean);
+}
+
+/*
+ * @description	: ALS计数换算成mlux，查表后一次乘法和移位，不做除法
+ * @param - als	: ALS计数
+ * @param - range: 采样时的ALS量程
+ * @return 		: 光照强度，单位0.001lux
+ */
+static inline u32 ap3216c_als_to_mlux(u16 als, u8 range)
+{
+	return ((u64)als * ap3216c_mlux_lut[range]) >> AP3216C_LUX_SHIFT;
+}
+
+/*
+ * @description	: 软件复位AP3216C并使能ALS、PS+IR。
+ * 				  复位会清掉芯片里的配置，先把配置写入缓存，再用一次regcache_sync()恢复
+ * @param - dev	: ap3216c设备，调用者持有dev->lock
+ * @return 		: 0 成功;其他 失败
+ */
+static int ap3216c_chip_init(struct ap3216c_dev *dev)
+{
+	int ret;
+
+	mutex_lock(&dev->bus_lock);
+	/* 复位命令直接写到芯片，不进缓存 */
+	regcache_cache_bypass(dev->regmap, true);
+	ret = regmap_write(dev->regmap, AP3216C_SYSTEMCONG, AP3216C_MODE_RESET);	/* 软件复位AP3216C */
+	regcache_cache_bypass(dev->regmap, false);
+	if (ret)
+		goto out;
+	msleep(AP3216C_RESET_MS);												/* 睡眠等待复位完成，不占用CPU */
+
+	/* 复位后芯片处于掉电模式，缓存也要先记为掉电，避免同步时提前使能 */
+	regcache_cache_only(dev->regmap, true);
+	regmap_write(dev->regmap, AP3216C_SYSTEMCONG, AP3216C_MODE_POWERDOWN);
+	regcache_cache_only(dev->regmap, false);
+
+	/* 缓存里的配置一次性同步到芯片 */
+	regcache_mark_dirty(dev->regmap);
+	ret = regcache_sync(dev->regmap);
+	if (ret)
+		goto out;
+
+	/* 第一次初始化时缓存为空，这里真正写入；之后已由regcache_sync()恢复，不再访问总线 */
+	ap3216c_write_reg(dev, AP3216C_INTCLEAR, AP3216C_INTCLEAR_SW);		/* 中断标志由软件清除 	*/
+	ap3216c_write_thresh(dev);											/* 复位后恢复阈值 		*/
+	ap3216c_write_config(dev);											/* 量程、增益、积分时间 */
+
+	ret = ap3216c_write_reg(dev, AP3216C_SYSTEMCONG, AP3216C_MODE_ALS_PS_IR);	/* 使能ALS、PS+IR */
+	if (!ret)
+		dev->ready = true;
+out:
+	mutex_unlock(&dev->bus_lock);
+	return ret;
+}
+
+/*
+ * @description	: 启动采样线程
+ * @param - dev	: ap3216c设备，调用者持有dev->lock
+ * @return 		: 0 成功;其他 失败
+ */
+static int ap3216c_start_sampler(struct ap3216c_dev *dev)
+{
+	struct task_struct *t;
+
+	t = kthread_run(ap3216c_sampler_thread, dev, "%s-%d-%02x", AP3216C_NAME,
+					i2c_adapter_id(dev->client->adapter), dev->client->addr);
+	if (IS_ERR(t))
+		return PTR_ERR(t);
+
+	dev->sampler = t;
+	return 0;
+}
+
+/*
+ * @description	: 最后一个引用释放时释放设备结构体
+ * @param - ref	: ap3216c_dev中的kref
+ * @return 		: 无
+ */
+static void ap3216c_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct ap3216c_dev, ref));
+}
+
+/*
+ * @description	: devm动作：释放probe持有的引用，在所有devm资源(中断、IIO、regmap)之后执行
+ * @param - data: ap3216c设备
+ * @return 		: 无
+ */
+static void ap3216c_put(void *data)
+{
+	struct ap3216c_dev *dev = data;
+
+	kref_put(&dev->ref, ap3216c_free);
 }
 
 /*
@@ -168,19 +528,72 @@ void ap3216c_readdata(struct ap3216c_dev *dev)
  */
 static int ap3216c_open(struct inode *inode, struct file *filp)
 {
-	/* 从file结构体获取cdev的指针，在根据cdev获取ap3216c_dev结构体的首地址 */
-	struct cdev *cdev = filp->f_path.dentry->d_inode->i_cdev;
-	struct ap3216c_dev *ap3216cdev = container_of(cdev, struct ap3216c_dev, cdev);
+	struct ap3216c_dev *ap3216cdev;
+	struct ap3216c_file *f;
+	int ret = 0;
 
-	/* 初始化AP3216C :给寄存器写入对应值即可*/
-	ap3216c_write_reg(ap3216cdev, AP3216C_SYSTEMCONG, 0x04);		/* 写 0x04,软件复位AP3216C 			*/
-	mdelay(50);														/* AP3216C复位最少10ms 	*/
-	ap3216c_write_reg(ap3216cdev, AP3216C_SYSTEMCONG, 0X03);		/* 写 0x03，使能ALS、PS+IR 		*/
-	return 0;
+	/* 由次设备号查找设备并持有一个引用，remove之后设备结构体一直保留到文件关闭 */
+	mutex_lock(&ap3216c_idr_lock);
+	ap3216cdev = idr_find(&ap3216c_idr, iminor(inode));
+	if (ap3216cdev)
+		kref_get(&ap3216cdev->ref);
+	mutex_unlock(&ap3216c_idr_lock);
+	if (!ap3216cdev)
+		return -ENODEV;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f) {
+		ret = -ENOMEM;
+		goto put_dev;
+	}
+	f->dev = ap3216cdev;
+	mutex_init(&f->lock);
+
+	mutex_lock(&ap3216cdev->lock);
+	/* 打开期间设备被移除 */
+	if (ap3216cdev->removed) {
+		ret = -ENODEV;
+		goto out;
+	}
+	/* 芯片在probe中已经初始化，open不再复位芯片、不访问总线；只有初始化失败才在这里重试 */
+	if (!ap3216cdev->ready) {
+		ret = ap3216c_pm_get(ap3216cdev);
+		if (ret)
+			goto out;
+		ret = ap3216c_chip_init(ap3216cdev);
+		ap3216c_pm_put(ap3216cdev);
+		if (ret)
+			goto out;
+	}
+
+	/* 第一个打开者启动采样线程，采样线程按需唤醒芯片；
+	 * 中断模式下由INT引脚产生记录，打开期间芯片要一直工作 */
+	if (ap3216cdev->users == 0) {
+		if (ap3216cdev->irq)
+			ret = ap3216c_pm_get(ap3216cdev);
+		else
+			ret = ap3216c_start_sampler(ap3216cdev);
+		if (ret)
+			goto out;
+	}
+	ap3216cdev->users++;
+	/* 新打开的文件只读取打开之后的采样 */
+	f->tail = smp_load_acquire(&ap3216cdev->head);
+	filp->private_data = f;
+out:
+	mutex_unlock(&ap3216cdev->lock);
+	if (!ret)
+		return 0;
+	kfree(f);
+put_dev:
+	kref_put(&ap3216cdev->ref, ap3216c_free);
+	return ret;
 }
 
 /*
- * @description		: 从设备读取数据 
+ * @description		: 从设备读取数据，不访问I2C总线，只从环形缓冲区批量取记录。
+ * 					  cnt不小于一条记录(由AP3216C_SET_FORMAT选择raw或lux格式)时返回尽可能多的记录；
+ * 					  否则兼容旧接口，返回最新一次采样的short[3]
  * @param - filp 	: 要打开的设备文件(文件描述符)
  * @param - buf 	: 返回给用户空间的数据缓冲区
  * @param - cnt 	: 要读取的数据长度
@@ -189,37 +602,545 @@ static int ap3216c_open(struct inode *inode, struct file *filp)
  */
 static ssize_t ap3216c_read(struct file *filp, char __user *buf, size_t cnt, loff_t *off)
 {
+	struct ap3216c_file *f = filp->private_data;
+	struct ap3216c_dev *dev = f->dev;
+	struct ap3216c_record *batch = f->batch;
+	size_t size, i, n, total = 0;
 	short data[3];
-	long err = 0;
+	ssize_t ret;
 
-	struct cdev *cdev = filp->f_path.dentry->d_inode->i_cdev;
-	struct ap3216c_dev *dev = container_of(cdev, struct ap3216c_dev, cdev);	//获取struct ap3216c_dev的首地址
-	
-	ap3216c_readdata(dev);
+	if (mutex_lock_interruptible(&f->lock))
+		return -ERESTARTSYS;
 
-	data[0] = dev->ir;
-	data[1] = dev->als;
-	data[2] = dev->ps;
-	// 数据发送到用户空间，由read的fd接受
-	err = copy_to_user(buf, data, sizeof(data));
-	return 0;
+	/* 没有新记录：设备已移除返回-ENODEV，非阻塞返回-EAGAIN，阻塞则等待采样线程唤醒 */
+	while (!ap3216c_ring_avail(dev, f->tail)) {
+		if (READ_ONCE(dev->removed)) {
+			ret = -ENODEV;
+			goto out;
+		}
+		if (filp->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto out;
+		}
+		mutex_unlock(&f->lock);
+		ret = wait_event_interruptible(dev->r_wait, ap3216c_ring_avail(dev, f->tail) ||
+									   READ_ONCE(dev->removed));
+		if (ret)
+			return ret;
+		if (mutex_lock_interruptible(&f->lock))
+			return -ERESTARTSYS;
+	}
+
+	size = (f->format == AP3216C_FMT_LUX) ? sizeof(f->out.lux[0]) : sizeof(f->out.raw[0]);
+
+	/* 旧接口：只返回最新的一条 */
+	if (cnt < size) {
+		f->tail = smp_load_acquire(&dev->head) - 1;
+		ap3216c_ring_get(dev, &f->tail, batch, 1);
+		data[0] = batch[0].s.ir;
+		data[1] = batch[0].s.als;
+		data[2] = batch[0].s.ps;
+		// 数据发送到用户空间，由read的fd接受
+		ret = copy_to_user(buf, data, sizeof(data)) ? -EFAULT : 0;
+		goto out;
+	}
+
+	/* 批量拷贝，直到用户缓冲区满或没有新记录 */
+	while (cnt - total >= size) {
+		n = min_t(size_t, (cnt - total) / size, AP3216C_READ_BATCH);
+		n = ap3216c_ring_get(dev, &f->tail, batch, n);
+		if (!n)
+			break;
+		for (i = 0; i < n; i++) {
+			if (f->format == AP3216C_FMT_LUX) {
+				memset(&f->out.lux[i], 0, sizeof(f->out.lux[i]));
+				f->out.lux[i].timestamp = batch[i].s.timestamp;
+				f->out.lux[i].als_mlux = ap3216c_als_to_mlux(batch[i].s.als, batch[i].als_range);
+				f->out.lux[i].ir = batch[i].s.ir;
+				f->out.lux[i].ps = batch[i].s.ps;
+				f->out.lux[i].flags = batch[i].s.flags;
+			} else {
+				f->out.raw[i] = batch[i].s;
+			}
+		}
+		if (copy_to_user(buf + total, &f->out, n * size)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		total += n * size;
+	}
+	ret = total;
+out:
+	mutex_unlock(&f->lock);
+	return ret;
+}
+
+/*
+ * @description		: ioctl函数：设置/读取ALS、PS中断阈值，量程、增益、积分时间，以及read()格式
+ * @param - filp 	: 要打开的设备文件(文件描述符)
+ * @param - cmd 	: 应用程序发送过来的命令
+ * @param - arg 	: 参数，struct ap3216c_thresh/ap3216c_config或unsigned int的用户空间地址
+ * @return 			: 0 成功;其他 失败
+ */
+static long ap3216c_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct ap3216c_file *f = filp->private_data;
+	struct ap3216c_dev *dev = f->dev;
+	struct ap3216c_thresh th;
+	struct ap3216c_thresh *cur;
+	struct ap3216c_config cfg;
+	unsigned int format;
+	void __user *uarg = (void __user *)arg;
+	int ret = 0;
+
+	switch (cmd) {
+	case AP3216C_SET_ALS_THRESH:
+	case AP3216C_SET_PS_THRESH:
+		if (copy_from_user(&th, uarg, sizeof(th)))
+			return -EFAULT;
+		if (th.low > th.high)
+			return -EINVAL;
+		if (cmd == AP3216C_SET_PS_THRESH && th.high > 0x3FF)	/* PS只有10位 */
+			return -EINVAL;
+
+		cur = (cmd == AP3216C_SET_ALS_THRESH) ? &dev->als_thresh : &dev->ps_thresh;
+		/* remove之后regmap已经释放，不再访问 */
+		mutex_lock(&dev->lock);
+		if (dev->removed) {
+			mutex_unlock(&dev->lock);
+			return -ENODEV;
+		}
+		mutex_lock(&dev->bus_lock);
+		*cur = th;
+		if (dev->ready)
+			ap3216c_write_thresh(dev);
+		mutex_unlock(&dev->bus_lock);
+		mutex_unlock(&dev->lock);
+		return 0;
+
+	case AP3216C_GET_ALS_THRESH:
+	case AP3216C_GET_PS_THRESH:
+		cur = (cmd == AP3216C_GET_ALS_THRESH) ? &dev->als_thresh : &dev->ps_thresh;
+		mutex_lock(&dev->lock);
+		th = *cur;
+		mutex_unlock(&dev->lock);
+		return copy_to_user(uarg, &th, sizeof(th)) ? -EFAULT : 0;
+
+	case AP3216C_SET_CONFIG:
+		if (copy_from_user(&cfg, uarg, sizeof(cfg)))
+			return -EFAULT;
+		if (cfg.als_range > 3 || cfg.ps_gain > 3 || cfg.ps_integ > 15 || cfg.ps_mean > 3)
+			return -EINVAL;
+
+		/* 芯片掉电时只写入缓存，恢复工作模式时由regcache_sync()写入芯片 */
+		mutex_lock(&dev->lock);
+		if (dev->removed) {
+			mutex_unlock(&dev->lock);
+			return -ENODEV;
+		}
+		mutex_lock(&dev->bus_lock);
+		dev->cfg = cfg;
+		if (dev->ready)
+			ret = ap3216c_write_config(dev);
+		mutex_unlock(&dev->bus_lock);
+		mutex_unlock(&dev->lock);
+		return ret;
+
+	case AP3216C_GET_CONFIG:
+		mutex_lock(&dev->bus_lock);
+		cfg = dev->cfg;
+		mutex_unlock(&dev->bus_lock);
+		return copy_to_user(uarg, &cfg, sizeof(cfg)) ? -EFAULT : 0;
+
+	case AP3216C_SET_FORMAT:
+		if (get_user(format, (unsigned int __user *)uarg))
+			return -EFAULT;
+		if (format != AP3216C_FMT_RAW && format != AP3216C_FMT_LUX)
+			return -EINVAL;
+		mutex_lock(&f->lock);
+		f->format = format;
+		mutex_unlock(&f->lock);
+		return 0;
+
+	case AP3216C_GET_FORMAT:
+		return put_user(f->format, (unsigned int __user *)uarg);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
+/*
+ * @description     : poll函数，用于处理非阻塞访问
+ * @param - filp    : 要打开的设备文件(文件描述符)
+ * @param - wait    : 等待列表(poll_table)
+ * @return          : 设备或者资源状态
+ */
+static __poll_t ap3216c_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct ap3216c_file *f = filp->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &f->dev->r_wait, wait);
+	if (ap3216c_ring_avail(f->dev, READ_ONCE(f->tail)))	/* 有未读记录 */
+		mask = EPOLLIN | EPOLLRDNORM;
+	if (READ_ONCE(f->dev->removed))						/* 设备已移除 */
+		mask |= EPOLLHUP | EPOLLERR;
+
+	return mask;
 }
 
 /*
- * @description		: 关闭/释放设备
+ * @description	: 停止采样线程
+ * @param - dev	: ap3216c设备，调用者持有dev->lock
+ * @return 		: 无
+ */
+static void ap3216c_stop_sampler(struct ap3216c_dev *dev)
+{
+	if (dev->sampler) {
+		kthread_stop(dev->sampler);
+		dev->sampler = NULL;
+	}
+}
+
+/*
+ * @description		: 关闭/释放设备，最后一个打开者关闭时停止采样线程；
+ * 					  设备已经移除时采样线程和运行时PM引用已由remove处理，只释放引用
  * @param - filp 	: 要关闭的设备文件(文件描述符)
  * @return 			: 0 成功;其他 失败
  */
 static int ap3216c_release(struct inode *inode, struct file *filp)
 {
+	struct ap3216c_file *f = filp->private_data;
+	struct ap3216c_dev *dev = f->dev;
+
+	mutex_lock(&dev->lock);
+	if (--dev->users == 0 && !dev->removed) {
+		if (dev->irq)
+			ap3216c_pm_put(dev);
+		else
+			ap3216c_stop_sampler(dev);
+	}
+	mutex_unlock(&dev->lock);
+
+	kfree(f);
+	kref_put(&dev->ref, ap3216c_free);
 	return 0;
 }
 
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+/* IIO扫描序号，同时也是scan.channels[]的取值顺序 */
+enum ap3216c_scan {
+	AP3216C_SCAN_IR = 0,
+	AP3216C_SCAN_ALS,
+	AP3216C_SCAN_PS,
+	AP3216C_SCAN_TIMESTAMP,
+};
+
+/* IIO通道：IR强度、ALS照度、PS接近，每个通道占16位，另加软件时间戳 */
+static const struct iio_chan_spec ap3216c_channels[] = {
+	{
+		.type = IIO_INTENSITY,
+		.modified = 1,
+		.channel2 = IIO_MOD_LIGHT_IR,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+		.scan_index = AP3216C_SCAN_IR,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 10,
+			.storagebits = 16,
+			.endianness = IIO_CPU,
+		},
+	},
+	{
+		.type = IIO_LIGHT,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+		.scan_index = AP3216C_SCAN_ALS,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 16,
+			.storagebits = 16,
+			.endianness = IIO_CPU,
+		},
+	},
+	{
+		.type = IIO_PROXIMITY,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+		.scan_index = AP3216C_SCAN_PS,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 10,
+			.storagebits = 16,
+			.endianness = IIO_CPU,
+		},
+	},
+	IIO_CHAN_SOFT_TIMESTAMP(AP3216C_SCAN_TIMESTAMP),
+};
+
+/*
+ * @description	: 唤醒芯片，芯片还没有初始化时先初始化，并等待第一次转换完成
+ * @param - dev	: ap3216c设备
+ * @return 		: 0 成功;其他 失败
+ */
+static int ap3216c_iio_enable(struct ap3216c_dev *dev)
+{
+	int ret;
+
+	ret = ap3216c_pm_get(dev);
+	if (ret)
+		return ret;
+
+	mutex_lock(&dev->lock);
+	if (!dev->ready) {
+		ret = ap3216c_chip_init(dev);
+		if (!ret)
+			msleep(AP3216C_MIN_PERIOD_MS);
+	}
+	mutex_unlock(&dev->lock);
+
+	if (ret)
+		ap3216c_pm_put(dev);
+	return ret;
+}
+
+/*
+ * @description	: 触发缓冲区的填充函数：复用ap3216c_readdata()读取一次数据，
+ * 				  按使能的通道紧凑排列后连同时间戳推入IIO缓冲区
+ * @param - irq	: 未使用
+ * @param - p	: iio_poll_func
+ * @return 		: IRQ_HANDLED
+ */
+static irqreturn_t ap3216c_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct ap3216c_dev *dev = *(struct ap3216c_dev **)iio_priv(indio_dev);
+	unsigned short val[3];
+	int bit, i = 0;
+
+	mutex_lock(&dev->bus_lock);
+	if (ap3216c_readdata(dev) < 0) {
+		mutex_unlock(&dev->bus_lock);
+		goto done;
+	}
+	val[AP3216C_SCAN_IR] = dev->ir;
+	val[AP3216C_SCAN_ALS] = dev->als;
+	val[AP3216C_SCAN_PS] = dev->ps;
+	mutex_unlock(&dev->bus_lock);
+
+	for_each_set_bit(bit, indio_dev->active_scan_mask, indio_dev->masklength)
+		dev->scan.channels[i++] = val[bit];
+
+	iio_push_to_buffers_with_timestamp(indio_dev, &dev->scan, pf->timestamp);
+done:
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+/*
+ * @description	: 通过sysfs的in_xxx_raw读取一次数据
+ * @return 		: IIO_VAL_INT 成功;其他 失败
+ */
+static int ap3216c_read_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+							int *val, int *val2, long mask)
+{
+	struct ap3216c_dev *dev = *(struct ap3216c_dev **)iio_priv(indio_dev);
+	int ret;
+
+	if (mask != IIO_CHAN_INFO_RAW)
+		return -EINVAL;
+
+	/* 缓冲区模式下由触发器读取数据 */
+	ret = iio_device_claim_direct_mode(indio_dev);
+	if (ret)
+		return ret;
+
+	ret = ap3216c_iio_enable(dev);
+	if (ret) {
+		iio_device_release_direct_mode(indio_dev);
+		return ret;
+	}
+
+	mutex_lock(&dev->bus_lock);
+	ret = ap3216c_readdata(dev);
+	if (!ret) {
+		switch (chan->scan_index) {
+		case AP3216C_SCAN_IR:
+			*val = dev->ir;
+			break;
+		case AP3216C_SCAN_ALS:
+			*val = dev->als;
+			break;
+		default:
+			*val = dev->ps;
+			break;
+		}
+		ret = IIO_VAL_INT;
+	}
+	mutex_unlock(&dev->bus_lock);
+	ap3216c_pm_put(dev);
+
+	iio_device_release_direct_mode(indio_dev);
+	return ret;
+}
+
+/*
+ * @description	: 使能缓冲区之前先唤醒芯片，缓冲区使能期间芯片一直工作
+ * @return 		: 0 成功;其他 失败
+ */
+static int ap3216c_buffer_preenable(struct iio_dev *indio_dev)
+{
+	return ap3216c_iio_enable(*(struct ap3216c_dev **)iio_priv(indio_dev));
+}
+
+/*
+ * @description	: 关闭缓冲区之后允许芯片自动掉电
+ * @return 		: 0
+ */
+static int ap3216c_buffer_postdisable(struct iio_dev *indio_dev)
+{
+	ap3216c_pm_put(*(struct ap3216c_dev **)iio_priv(indio_dev));
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops ap3216c_buffer_ops = {
+	.preenable = ap3216c_buffer_preenable,
+	.postenable = iio_triggered_buffer_postenable,
+	.predisable = iio_triggered_buffer_predisable,
+	.postdisable = ap3216c_buffer_postdisable,
+};
+
+static const struct iio_info ap3216c_iio_info = {
+	.read_raw = ap3216c_read_raw,
+};
+
+/*
+ * @description	: 注册IIO设备与触发缓冲区，触发器由用户选择(如iio-trig-hrtimer)，
+ * 				  时间戳在触发器的上半部采集(iio_pollfunc_store_time)
+ * @param - dev	: ap3216c设备
+ * @return 		: 0 成功;其他 失败
+ */
+static int ap3216c_iio_register(struct ap3216c_dev *dev)
+{
+	struct device *parent = &dev->client->dev;
+	struct iio_dev *indio_dev;
+	int ret;
+
+	indio_dev = devm_iio_device_alloc(parent, sizeof(dev));
+	if (!indio_dev)
+		return -ENOMEM;
+	*(struct ap3216c_dev **)iio_priv(indio_dev) = dev;
+
+	indio_dev->dev.parent = parent;
+	indio_dev->name = AP3216C_NAME;
+	indio_dev->info = &ap3216c_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = ap3216c_channels;
+	indio_dev->num_channels = ARRAY_SIZE(ap3216c_channels);
+
+	ret = devm_iio_triggered_buffer_setup(parent, indio_dev, iio_pollfunc_store_time,
+										  ap3216c_trigger_handler, &ap3216c_buffer_ops);
+	if (ret)
+		return ret;
+
+	ret = devm_iio_device_register(parent, indio_dev);
+	if (ret)
+		return ret;
+
+	dev->indio_dev = indio_dev;
+	return 0;
+}
+#else
+static int ap3216c_iio_register(struct ap3216c_dev *dev)
+{
+	return 0;
+}
+#endif
+
+/*
+ * @description	: 运行时挂起：写入掉电模式，之后的配置写入只进缓存
+ * @param - d	: i2c设备的device
+ * @return 		: 0 成功;其他 失败
+ */
+static int __maybe_unused ap3216c_runtime_suspend(struct device *d)
+{
+	struct ap3216c_dev *dev = i2c_get_clientdata(to_i2c_client(d));
+	int ret;
+
+	mutex_lock(&dev->bus_lock);
+	ret = ap3216c_write_reg(dev, AP3216C_SYSTEMCONG, AP3216C_MODE_POWERDOWN);
+	if (!ret)
+		regcache_cache_only(dev->regmap, true);
+	mutex_unlock(&dev->bus_lock);
+
+	if (!ret)
+		atomic_inc(&dev->suspend_count);
+	return ret;
+}
+
+/*
+ * @description	: 运行时恢复：把掉电期间缓存的配置同步到芯片，恢复ALS+PS+IR模式，
+ * 				  并等待第一次转换完成，保证恢复后读到的数据有效
+ * @param - d	: i2c设备的device
+ * @return 		: 0 成功;其他 失败
+ */
+static int __maybe_unused ap3216c_runtime_resume(struct device *d)
+{
+	struct ap3216c_dev *dev = i2c_get_clientdata(to_i2c_client(d));
+	int ret;
+
+	mutex_lock(&dev->bus_lock);
+	regcache_cache_only(dev->regmap, false);
+	ret = regcache_sync(dev->regmap);
+	if (!ret)
+		ret = ap3216c_write_reg(dev, AP3216C_SYSTEMCONG, AP3216C_MODE_ALS_PS_IR);
+	mutex_unlock(&dev->bus_lock);
+	if (ret)
+		return ret;
+
+	msleep(AP3216C_MIN_PERIOD_MS);
+	atomic_inc(&dev->resume_count);
+	return 0;
+}
+
+static const struct dev_pm_ops ap3216c_pm_ops = {
+	SET_RUNTIME_PM_OPS(ap3216c_runtime_suspend, ap3216c_runtime_resume, NULL)
+};
+
+/* sysfs：掉电/恢复次数，工作与空闲时间见同目录下power/runtime_active_time、runtime_suspended_time */
+static ssize_t suspend_count_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ap3216c_dev *dev = i2c_get_clientdata(to_i2c_client(d));
+
+	return sprintf(buf, "%d\n", atomic_read(&dev->suspend_count));
+}
+static DEVICE_ATTR_RO(suspend_count);
+
+static ssize_t resume_count_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ap3216c_dev *dev = i2c_get_clientdata(to_i2c_client(d));
+
+	return sprintf(buf, "%d\n", atomic_read(&dev->resume_count));
+}
+static DEVICE_ATTR_RO(resume_count);
+
+static struct attribute *ap3216c_attrs[] = {
+	&dev_attr_suspend_count.attr,
+	&dev_attr_resume_count.attr,
+	NULL
+};
+
+static const struct attribute_group ap3216c_attr_group = {
+	.attrs = ap3216c_attrs,
+};
+
 /* AP3216C操作函数 */
 static const struct file_operations ap3216c_ops = {
 	.owner = THIS_MODULE,
 	.open = ap3216c_open,
 	.read = ap3216c_read,
+	.poll = ap3216c_poll,
+	.unlocked_ioctl = ap3216c_unlocked_ioctl,
 	.release = ap3216c_release,
 };
 
@@ -233,54 +1154,123 @@ static int ap3216c_probe(struct i2c_client *client, const struct i2c_device_id *
 {
 	int ret;
 	struct ap3216c_dev *ap3216cdev;
+	ktime_t start = ktime_get();
 	
 	/* 0、驱动设备的内存申请 ************************************************************/
-	ap3216cdev = devm_kzalloc(&client->dev, sizeof(*ap3216cdev), GFP_KERNEL);
+	/* 设备结构体带引用计数，remove之后仍打开的文件还会访问它，不能用devm分配；
+	 * probe的引用由devm动作释放，排在后面申请的中断、IIO、regmap之后 */
+	ap3216cdev = kzalloc(sizeof(*ap3216cdev), GFP_KERNEL);
 	if(!ap3216cdev)
 		return -ENOMEM;
+	kref_init(&ap3216cdev->ref);
+	ret = devm_add_action_or_reset(&client->dev, ap3216c_put, ap3216cdev);
+	if (ret)
+		return ret;
+
+	/* regmap-i2c根据适配器能力选择传输方式：I2C组合传输 > SMBus块读 > SMBus字节读 */
+	ap3216cdev->regmap = devm_regmap_init_i2c(client, &ap3216c_regmap_config);
+	if (IS_ERR(ap3216cdev->regmap))
+		return PTR_ERR(ap3216cdev->regmap);
+	ap3216cdev->client = client;
+	/* set/get()方法：保存ap3216cdev结构体：将 ap3216cdev 变量的地址绑定到 client； */
+	i2c_set_clientdata(client,ap3216cdev);
+	init_waitqueue_head(&ap3216cdev->r_wait);
+	mutex_init(&ap3216cdev->lock);
+	mutex_init(&ap3216cdev->bus_lock);
+
+	/* 默认阈值为整个量程，不会产生中断，由应用程序通过ioctl设置 */
+	ap3216cdev->als_thresh.high = 0xFFFF;
+	ap3216cdev->ps_thresh.high = 0x3FF;
+	ap3216cdev->cfg.ps_gain = 1;		/* 与芯片复位后的默认值一致 */
+
+	/* 设备树中给出了INT引脚(interrupts属性)时使用中断，INT低电平有效 */
+	if (client->irq > 0) {
+		ret = devm_request_threaded_irq(&client->dev, client->irq, NULL,
+										ap3216c_irq_thread, IRQF_ONESHOT,
+										AP3216C_NAME, ap3216cdev);
+		if (ret) {
+			dev_err(&client->dev, "request irq %d failed, ret=%d\n", client->irq, ret);
+			return ret;
+		}
+		ap3216cdev->irq = client->irq;
+	}
 		
 	/* 注册字符设备驱动 */
-	/* 1、创建设备号 */
-	ret = alloc_chrdev_region(&ap3216cdev->devid, 0, AP3216C_CNT, AP3216C_NAME);
-	if(ret < 0) {
-		pr_err("%s Couldn't alloc_chrdev_region, ret=%d\r\n", AP3216C_NAME, ret);
-		return -ENOMEM;
-	}
+	/* 1、分配次设备号，类和设备号范围在模块加载时已经创建，多个设备可以并行probe */
+	mutex_lock(&ap3216c_idr_lock);
+	ap3216cdev->minor = idr_alloc(&ap3216c_idr, ap3216cdev, 0, AP3216C_CNT, GFP_KERNEL);
+	mutex_unlock(&ap3216c_idr_lock);
+	if (ap3216cdev->minor < 0)
+		return ap3216cdev->minor;
+	ap3216cdev->devid = MKDEV(MAJOR(ap3216c_devt), ap3216cdev->minor);
 
-	/* 2、初始化cdev */
-	ap3216cdev->cdev.owner = THIS_MODULE;
-	cdev_init(&ap3216cdev->cdev, &ap3216c_ops);
+	/* 2、分配cdev：打开的文件持有cdev的引用，cdev不能嵌在设备结构体里 */
+	ap3216cdev->cdev = cdev_alloc();
+	if (!ap3216cdev->cdev) {
+		ret = -ENOMEM;
+		goto free_minor;
+	}
+	ap3216cdev->cdev->owner = THIS_MODULE;
+	ap3216cdev->cdev->ops = &ap3216c_ops;
 	
 	/* 3、添加一个cdev */
-	ret = cdev_add(&ap3216cdev->cdev, ap3216cdev->devid, AP3216C_CNT);
+	ret = cdev_add(ap3216cdev->cdev, ap3216cdev->devid, 1);
 	if(ret < 0) {
-		goto del_unregister;
-	}
-	
-	/* 4、创建类 */
-	ap3216cdev->class = class_create(THIS_MODULE, AP3216C_NAME);
-	if (IS_ERR(ap3216cdev->class)) {
-		goto del_cdev;
+		kobject_put(&ap3216cdev->cdev->kobj);
+		goto free_minor;
 	}
 
-	/* 5、创建设备 */
-	ap3216cdev->device = device_create(ap3216cdev->class, NULL, ap3216cdev->devid, NULL, AP3216C_NAME);
+	/* 4、创建设备：/dev/ap3216cN */
+	ap3216cdev->device = device_create(ap3216c_class, &client->dev, ap3216cdev->devid,
+									   ap3216cdev, AP3216C_NAME "%d", ap3216cdev->minor);
 	if (IS_ERR(ap3216cdev->device)) {
-		goto destroy_class;
+		ret = PTR_ERR(ap3216cdev->device);
+		goto del_cdev;
 	}
-	
-	ap3216cdev->client = client;
-	/* set/get()方法：保存ap3216cdev结构体：将 ap3216cdev 变量的地址绑定到 client； */
-	i2c_set_clientdata(client,ap3216cdev);
 
+	/* 5、注册IIO接口，与字符设备并存 */
+	ret = ap3216c_iio_register(ap3216cdev);
+	if (ret < 0)
+		goto destroy_device;
+
+	/* 6、掉电/恢复统计 */
+	ret = devm_device_add_group(&client->dev, &ap3216c_attr_group);
+	if (ret < 0)
+		goto destroy_device;
+
+	/* 7、运行时电源管理：芯片马上在下面使能，初始化期间持有一个引用，
+	 *    避免初始化还没结束就自动掉电 */
+	pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev, autosuspend_ms);
+	pm_runtime_use_autosuspend(&client->dev);
+	pm_runtime_get_noresume(&client->dev);
+	pm_runtime_enable(&client->dev);
+
+	/* 8、芯片只复位一次，失败时由第一次open重试。复位要睡眠10ms，
+	 *    驱动声明了PROBE_PREFER_ASYNCHRONOUS，probe本身已经在async线程中执行，
+	 *    多个AP3216C之间、与其他驱动之间并行，驱动核心在卸载前等待probe返回 */
+	mutex_lock(&ap3216cdev->lock);
+	if (!ap3216cdev->ready)
+		ret = ap3216c_chip_init(ap3216cdev);
+	mutex_unlock(&ap3216cdev->lock);
+	if (ret)
+		dev_warn(&client->dev, "chip init failed, ret=%d\n", ret);
+	trace_ap3216c_init(&client->dev, ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+
+	/* 释放初始化期间的引用，没有使用者时自动掉电 */
+	ap3216c_pm_put(ap3216cdev);
+
+	trace_ap3216c_probe(&client->dev, ktime_to_ns(ktime_sub(ktime_get(), start)));
 	return 0;
-destroy_class:
-	device_destroy(ap3216cdev->class, ap3216cdev->devid);
+destroy_device:
+	device_destroy(ap3216c_class, ap3216cdev->devid);
 del_cdev:
-	cdev_del(&ap3216cdev->cdev);
-del_unregister:
-	unregister_chrdev_region(ap3216cdev->devid, AP3216C_CNT);
-	return -EIO;
+	cdev_del(ap3216cdev->cdev);
+free_minor:
+	mutex_lock(&ap3216c_idr_lock);
+	idr_remove(&ap3216c_idr, ap3216cdev->minor);
+	mutex_unlock(&ap3216c_idr_lock);
+	return ret;
 }
 
 /*
@@ -291,15 +1281,34 @@ del_unregister:
 static int ap3216c_remove(struct i2c_client *client)
 {
 	struct ap3216c_dev *ap3216cdev = i2c_get_clientdata(client);	//得到 ap3216cdev 变量的地址
+
+	/* 设备被移除时不再访问总线，之后的open返回-ENODEV；还打开着的文件只能读走剩余记录，
+	 * 它们持有的运行时PM引用在这里释放，release不再访问i2c设备 */
+	mutex_lock(&ap3216cdev->lock);
+	ap3216c_stop_sampler(ap3216cdev);
+	if (ap3216cdev->users && ap3216cdev->irq)
+		pm_runtime_put_noidle(&client->dev);
+	ap3216cdev->removed = true;
+	mutex_unlock(&ap3216cdev->lock);
+	wake_up_interruptible(&ap3216cdev->r_wait);
+
+	/* 关闭运行时电源管理，芯片进入掉电模式 */
+	pm_runtime_disable(&client->dev);
+	if (!pm_runtime_status_suspended(&client->dev))
+		ap3216c_runtime_suspend(&client->dev);
+	pm_runtime_set_suspended(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
+
 	/* 注销字符设备驱动 */
-	/* 1、删除cdev */
-	cdev_del(&ap3216cdev->cdev);
-	/* 2、注销设备号 */
-	unregister_chrdev_region(ap3216cdev->devid, AP3216C_CNT); 
-	/* 3、注销设备 */
-	device_destroy(ap3216cdev->class, ap3216cdev->devid);
-	/* 4、注销类 */
-	class_destroy(ap3216cdev->class); 
+	/* 1、注销设备 */
+	device_destroy(ap3216c_class, ap3216cdev->devid);
+	/* 2、删除cdev，打开的文件关闭后由内核释放 */
+	cdev_del(ap3216cdev->cdev);
+	/* 3、释放次设备号，类和设备号范围在模块卸载时释放；
+	 *    设备结构体在devm动作和最后一个文件关闭后释放 */
+	mutex_lock(&ap3216c_idr_lock);
+	idr_remove(&ap3216c_idr, ap3216cdev->minor);
+	mutex_unlock(&ap3216c_idr_lock);
 	return 0;
 }
 
@@ -322,27 +1331,56 @@ static struct i2c_driver ap3216c_driver = {
 	.driver = {
 			.owner = THIS_MODULE,
 		   	.name = "ap3216c",
+			.pm = &ap3216c_pm_ops,
+			.probe_type = PROBE_PREFER_ASYNCHRONOUS,	/* 多个设备与其他驱动并行probe */
 		   	.of_match_table = ap3216c_of_match, 
 		   },
 	.id_table = ap3216c_id,
 };
 		   
 /*
- * @description	: 驱动入口函数，调用add向内核注册驱动
+ * @description	: 驱动入口函数，申请所有设备共用的设备号范围和类，再调用add向内核注册驱动
  */
 static int __init ap3216c_init(void)
 {
 	int ret = 0;
+
+	/* 1、申请设备号范围 */
+	ret = alloc_chrdev_region(&ap3216c_devt, 0, AP3216C_CNT, AP3216C_NAME);
+	if (ret < 0) {
+		pr_err("%s Couldn't alloc_chrdev_region, ret=%d\r\n", AP3216C_NAME, ret);
+		return ret;
+	}
+
+	/* 2、创建类 */
+	ap3216c_class = class_create(THIS_MODULE, AP3216C_NAME);
+	if (IS_ERR(ap3216c_class)) {
+		ret = PTR_ERR(ap3216c_class);
+		goto del_unregister;
+	}
+
+	/* 3、注册i2c驱动 */
 	ret = i2c_add_driver(&ap3216c_driver);
+	if (ret)
+		goto destroy_class;
+	return 0;
+
+destroy_class:
+	class_destroy(ap3216c_class);
+del_unregister:
+	unregister_chrdev_region(ap3216c_devt, AP3216C_CNT);
 	return ret;
 }
 
 /*
- * @description	: 驱动出口函数。调用del卸载驱动
+ * @description	: 驱动出口函数。调用del卸载驱动，再释放类和设备号范围
  */
 static void __exit ap3216c_exit(void)
 {
 	i2c_del_driver(&ap3216c_driver);
+	class_destroy(ap3216c_class);
+	unregister_chrdev_region(ap3216c_devt, AP3216C_CNT);
+	idr_destroy(&ap3216c_idr);
 }
 
 /* module_i2c_driver(ap3216c_driver) */
@@ -4,7 +4,9 @@
 版本	   	: V1.0
 描述	   	: ap3216c设备测试APP。
 其他	   	: 无
-使用方法	 ：./ap3216cApp /dev/ap3216c
+使用方法	 ：./ap3216cApp /dev/ap3216c0
+			   ./ap3216cApp /dev/ap3216c0 <als_low> <als_high>	@ 设置ALS中断阈值(需要INT引脚)
+			   ./ap3216cApp /dev/ap3216c0 <als_range>			@ 设置ALS量程0~3，输出lux
 ***************************************************************/
 #include "stdio.h"
 #include "unistd.h"
@@ -19,6 +21,10 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <fcntl.h>
+#include "ap3216creg.h"
+
+#define SAMPLE_BATCH	16	/* 一次read()最多读取的记录数 */
+
 /*
  * @description		: main主程序
  * @param - argc 	: argv数组元素个数
@@ -29,11 +35,15 @@ int main(int argc, char *argv[])
 {
 	int fd;
 	char *filename;
-	unsigned short databuf[3];
-	unsigned short ir, als, ps;
+	struct ap3216c_sample samples[SAMPLE_BATCH];
+	struct ap3216c_lux_sample lux[SAMPLE_BATCH];
+	struct ap3216c_config cfg;
+	unsigned int format = AP3216C_FMT_RAW;
 	int ret = 0;
+	int i;
+	struct ap3216c_thresh th;
 
-	if (argc != 2) {
+	if (argc < 2 || argc > 4) {
 		printf("Error Usage!\r\n");
 		return -1;
 	}
@@ -45,16 +55,56 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	// 从设备的fd读取数据到databuf,并输出；
-	while (1) {
-		ret = read(fd, databuf, sizeof(databuf));
-		if(ret == 0) { 			/* 数据读取成功 */
-			ir =  databuf[0]; 	/* ir传感器数据 */
-			als = databuf[1]; 	/* als传感器数据 */
-			ps =  databuf[2]; 	/* ps传感器数据 */
-			printf("ir = %d, als = %d, ps = %d\r\n", ir, als, ps);
+	/* 中断模式下只有ALS数据超出[als_low,als_high]时才会读到数据 */
+	if (argc == 4) {
+		th.low = atoi(argv[2]);
+		th.high = atoi(argv[3]);
+		if (ioctl(fd, AP3216C_SET_ALS_THRESH, &th) < 0)
+			printf("set als thresh failed!\r\n");
+	}
+
+	/* 修改量程后按lux格式读取，驱动用采样时的量程换算 */
+	if (argc == 3) {
+		if (ioctl(fd, AP3216C_GET_CONFIG, &cfg) < 0) {
+			printf("get config failed!\r\n");
+			close(fd);
+			return -1;
+		}
+		cfg.als_range = atoi(argv[2]);
+		format = AP3216C_FMT_LUX;
+		if (ioctl(fd, AP3216C_SET_CONFIG, &cfg) < 0 ||
+			ioctl(fd, AP3216C_SET_FORMAT, &format) < 0) {
+			printf("set als range failed!\r\n");
+			close(fd);
+			return -1;
+		}
+	}
+
+	while (format == AP3216C_FMT_LUX) {
+		ret = read(fd, lux, sizeof(lux));
+		if (ret < 0)
+			break;
+		for (i = 0; i < ret / (int)sizeof(struct ap3216c_lux_sample); i++) {
+			printf("[%lld.%03lld] ir = %d, als = %u.%03u lux, ps = %d%s\r\n",
+				   lux[i].timestamp / 1000000000LL,
+				   lux[i].timestamp / 1000000LL % 1000,
+				   lux[i].ir, lux[i].als_mlux / 1000, lux[i].als_mlux % 1000, lux[i].ps,
+				   lux[i].flags ? " (threshold)" : "");
+		}
+	}
+
+	// 从设备的fd批量读取采样记录,并输出；没有新数据时read()阻塞，由驱动的采样线程唤醒
+	while (format == AP3216C_FMT_RAW) {
+		ret = read(fd, samples, sizeof(samples));
+		if (ret < 0)
+			break;
+		for (i = 0; i < ret / (int)sizeof(struct ap3216c_sample); i++) {
+			printf("[%lld.%03lld] ir = %d, als = %d, ps = %d%s\r\n",
+				   samples[i].timestamp / 1000000000LL,
+				   samples[i].timestamp / 1000000LL % 1000,
+				   samples[i].ir, samples[i].als, samples[i].ps,
+				   samples[i].flags ? " (threshold)" : "");
 		}
-		usleep(200000); /*100ms */
 	}
 	close(fd);	/* 关闭文件 */	
 	return 0;
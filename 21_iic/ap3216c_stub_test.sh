@@ -0,0 +1,93 @@
+#!/bin/sh
+###############################################################
+# 文件名		: ap3216c_stub_test.sh
+# 作者	  	: zhong
+# 版本	   	: V1.0
+# 描述	   	: 没有AP3216C硬件时用i2c-stub模拟芯片，统计模块加载时间、
+#			  probe耗时和芯片初始化耗时(ap3216c_probe/ap3216c_init跟踪点)
+# 使用方法	: ./ap3216c_stub_test.sh [ap3216c.ko]
+#			  需要root，内核打开CONFIG_I2C_STUB和CONFIG_FTRACE；
+#			  设备树中已经有ap3216c节点时先卸载ap3216c.ko再运行
+###############################################################
+
+KO=${1:-./ap3216c.ko}
+ADDR=0x1e
+TIMEOUT=5	# 等待芯片初始化完成的秒数
+
+# 1、找到tracefs
+if [ ! -d /sys/kernel/debug/tracing ]; then
+	mount -t debugfs none /sys/kernel/debug 2>/dev/null
+fi
+T=/sys/kernel/debug/tracing
+[ -d $T ] || T=/sys/kernel/tracing
+if [ ! -w $T/trace ]; then
+	echo "tracefs not found, need root and CONFIG_FTRACE"
+	exit 1
+fi
+
+# 2、加载i2c-stub，在0x1e模拟一个芯片，找到它的I2C总线
+modprobe i2c-stub chip_addr=$ADDR || exit 1
+BUS=
+for d in /sys/bus/i2c/devices/i2c-*; do
+	if grep -q "SMBus stub driver" $d/name 2>/dev/null; then
+		BUS=$d
+		break
+	fi
+done
+if [ -z "$BUS" ]; then
+	echo "i2c-stub adapter not found"
+	rmmod i2c-stub
+	exit 1
+fi
+echo "i2c-stub: $(basename $BUS), chip at $ADDR"
+
+# 3、清空跟踪缓冲区，打开跟踪
+echo 0 > $T/tracing_on
+echo > $T/trace
+echo 1 > $T/tracing_on
+
+# 4、加载驱动模块：前后写入trace_marker，由时间戳得到insmod的耗时
+echo "ap3216c: insmod start" > $T/trace_marker
+insmod $KO || { rmmod i2c-stub; exit 1; }
+echo "ap3216c: insmod done" > $T/trace_marker
+
+# 5、跟踪点在模块加载之后才存在，这时打开，再实例化设备触发probe
+echo 1 > $T/events/ap3216c/ap3216c_probe/enable
+echo 1 > $T/events/ap3216c/ap3216c_init/enable
+echo "ap3216c: new_device" > $T/trace_marker
+echo alientek,ap3216c $ADDR > $BUS/new_device
+
+# 6、probe在async线程中执行(PROBE_PREFER_ASYNCHRONOUS)，等待ap3216c_init事件
+i=0
+while ! grep -q "ap3216c_init:" $T/trace; do
+	i=$((i + 1))
+	if [ $i -gt $((TIMEOUT * 10)) ]; then
+		echo "timeout waiting for ap3216c_init"
+		break
+	fi
+	usleep 100000 2>/dev/null || sleep 1
+done
+
+# 7、打印跟踪记录和耗时
+echo
+grep "ap3216c" $T/trace
+echo
+awk '
+/ap3216c: insmod start/	{ for (i = 1; i <= NF; i++) if ($i ~ /^[0-9]+\.[0-9]+:$/) t0 = $i + 0 }
+/ap3216c: insmod done/	{ for (i = 1; i <= NF; i++) if ($i ~ /^[0-9]+\.[0-9]+:$/) t1 = $i + 0 }
+/ap3216c_probe:/	{ for (i = 1; i <= NF; i++) if ($i == "probe") probe = $(i + 1) }
+/ap3216c_init:/		{ for (i = 1; i <= NF; i++) if ($i == "ready") init = $(i + 1); ret = $NF }
+END {
+	if (t1 > 0)
+		printf("insmod      : %d us\n", (t1 - t0) * 1000000)
+	if (probe != "")
+		printf("probe       : %d us\n", probe / 1000)
+	if (init != "")
+		printf("chip init   : %d us after probe start, %s\n", init / 1000, ret)
+}' $T/trace
+
+# 8、清理：关闭跟踪点，删除设备，卸载模块
+echo 0 > $T/events/ap3216c/enable
+echo $ADDR > $BUS/delete_device
+rmmod ap3216c
+rmmod i2c-stub
@@ -0,0 +1,63 @@
+/***************************************************************
+文件名		: ap3216c_trace.h
+作者	  	: zhong
+版本	   	: V1.0
+描述	   	: AP3216C 驱动的跟踪点，统计probe与芯片初始化的耗时。
+			  使用方法：
+			  echo 1 > /sys/kernel/debug/tracing/events/ap3216c/enable
+			  insmod ap3216c.ko
+			  cat /sys/kernel/debug/tracing/trace
+			  没有AP3216C硬件时运行ap3216c_stub_test.sh：用i2c-stub在0x1e模拟芯片，
+			  加载模块后通过new_device实例化ap3216c，打印insmod、probe和芯片初始化的耗时
+其他	   	: 由ap3216c.c定义CREATE_TRACE_POINTS后包含
+***************************************************************/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ap3216c
+
+#if !defined(_AP3216C_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AP3216C_TRACE_H
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+/* probe返回时记录：包含芯片初始化，probe在async线程中执行，不阻塞insmod */
+TRACE_EVENT(ap3216c_probe,
+	TP_PROTO(struct device *dev, s64 probe_ns),
+	TP_ARGS(dev, probe_ns),
+	TP_STRUCT__entry(
+		__string(name, dev_name(dev))
+		__field(s64, probe_ns)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(dev));
+		__entry->probe_ns = probe_ns;
+	),
+	TP_printk("%s probe %lld ns", __get_str(name), __entry->probe_ns)
+);
+
+/* 芯片初始化结束时记录：从probe开始到芯片使能的耗时 */
+TRACE_EVENT(ap3216c_init,
+	TP_PROTO(struct device *dev, s64 init_ns, int ret),
+	TP_ARGS(dev, init_ns, ret),
+	TP_STRUCT__entry(
+		__string(name, dev_name(dev))
+		__field(s64, init_ns)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev_name(dev));
+		__entry->init_ns = init_ns;
+		__entry->ret = ret;
+	),
+	TP_printk("%s ready %lld ns after probe, ret=%d",
+			  __get_str(name), __entry->init_ns, __entry->ret)
+);
+
+#endif /* _AP3216C_TRACE_H */
+
+/* 跟踪头文件不在include/trace/events下，告诉define_trace.h到当前目录查找 */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ap3216c_trace
+#include <trace/define_trace.h>
@@ -13,10 +13,19 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 
 /* AP3316C寄存器 */
 #define AP3216C_SYSTEMCONG	0x00	/* 配置寄存器       */
-// 中断的两个寄存器没有用到
 #define AP3216C_INTSTATUS	0X01	/* 中断状态寄存器   */
 #define AP3216C_INTCLEAR	0X02	/* 中断清除寄存器   */
 
+/* 配置寄存器的工作模式 */
+#define AP3216C_MODE_POWERDOWN	0x00	/* 掉电模式(复位后默认)	*/
+#define AP3216C_MODE_ALS_PS_IR	0x03	/* 使能ALS、PS+IR 		*/
+#define AP3216C_MODE_RESET		0x04	/* 软件复位 			*/
+
+/* 中断状态寄存器的位，INTCLEAR写1后改为软件写1清除 */
+#define AP3216C_INT_ALS		0x01	/* ALS超出阈值窗口  */
+#define AP3216C_INT_PS		0x02	/* PS超出阈值窗口   */
+#define AP3216C_INTCLEAR_SW	0x01	/* 中断标志由软件清除 */
+
 // 6个数据寄存器，保存着ALS、PS、IR数据值
 #define AP3216C_IRDATALOW	0x0A	/* IR数据低字节     */
 #define AP3216C_IRDATAHIGH	0x0B	/* IR数据高字节     */
@@ -25,5 +34,76 @@ Copyright © ALIENTEK Co., Ltd. 1998-2029. All rights reserved.
 #define AP3216C_PSDATALOW	0X0E	/* PS数据低字节     */
 #define AP3216C_PSDATAHIGH	0X0F	/* PS数据高字节     */
 
+// 配置寄存器，改变量程、增益和积分时间
+#define AP3216C_ALSCONFIG	0x10	/* ALS配置：bit[5:4]量程，bit[3:0]中断持续次数 */
+#define AP3216C_PSCONFIG	0x20	/* PS配置：bit[7:4]积分时间，bit[3:2]增益	*/
+#define AP3216C_PSMEANTIME	0x23	/* PS平均时间：bit[1:0]					*/
+
+#define AP3216C_ALS_RANGE_SHIFT	4
+#define AP3216C_ALS_RANGE_MASK	0x30
+#define AP3216C_PS_INTEG_SHIFT	4
+#define AP3216C_PS_INTEG_MASK	0xF0
+#define AP3216C_PS_GAIN_SHIFT	2
+#define AP3216C_PS_GAIN_MASK	0x0C
+#define AP3216C_PS_MEAN_MASK	0x03
+
+// 阈值寄存器，数据超出[低阈值,高阈值]时INT引脚输出低电平
+#define AP3216C_ALSTHRESLL	0x1A	/* ALS低阈值低字节  */
+#define AP3216C_ALSTHRESLH	0x1B	/* ALS低阈值高字节  */
+#define AP3216C_ALSTHRESHL	0x1C	/* ALS高阈值低字节  */
+#define AP3216C_ALSTHRESHH	0x1D	/* ALS高阈值高字节  */
+#define AP3216C_PSTHRESLL	0x2A	/* PS低阈值bit[1:0] */
+#define AP3216C_PSTHRESLH	0x2B	/* PS低阈值bit[9:2] */
+#define AP3216C_PSTHRESHL	0x2C	/* PS高阈值bit[1:0] */
+#define AP3216C_PSTHRESHH	0x2D	/* PS高阈值bit[9:2] */
+
+/* 驱动与应用程序共用的数据格式 ***************************************/
+/* 采样记录：read()的缓冲区不小于一条记录时，一次返回尽可能多的记录 */
+struct ap3216c_sample {
+	long long timestamp;		/* 采样时间，CLOCK_MONOTONIC，单位ns */
+	unsigned short ir;			/* IR数据，10位  */
+	unsigned short als;			/* ALS数据，16位 */
+	unsigned short ps;			/* PS数据，10位  */
+	unsigned short flags;		/* 0:周期采样; 否则为触发中断的AP3216C_INT_xxx位 */
+};
+
+/* 阈值：数据低于low或高于high时产生中断 */
+struct ap3216c_thresh {
+	unsigned short low;
+	unsigned short high;
+};
+
+/* lux格式的采样记录：ALS换算成mlux，其他与struct ap3216c_sample相同 */
+struct ap3216c_lux_sample {
+	long long timestamp;		/* 采样时间，CLOCK_MONOTONIC，单位ns */
+	unsigned int als_mlux;		/* 光照强度，单位0.001lux */
+	unsigned short ir;			/* IR数据，10位  */
+	unsigned short ps;			/* PS数据，10位  */
+	unsigned short flags;		/* 同struct ap3216c_sample的flags */
+	unsigned short reserved[3];
+};
+
+/* 量程、增益和积分时间，对应芯片寄存器里的编码 */
+struct ap3216c_config {
+	unsigned char als_range;	/* ALS量程 0:20661lux 1:5162lux 2:1291lux 3:323lux */
+	unsigned char ps_gain;		/* PS增益 0~3: x1 x2 x4 x8，复位后为1 */
+	unsigned char ps_integ;		/* PS积分时间 0~15: 1T~16T */
+	unsigned char ps_mean;		/* PS平均时间 0~3: 12.5ms 25ms 37.5ms 50ms */
+};
+
+/* read()返回的记录格式，每个打开的文件独立设置 */
+#define AP3216C_FMT_RAW			0	/* struct ap3216c_sample，默认 */
+#define AP3216C_FMT_LUX			1	/* struct ap3216c_lux_sample */
+
+#define AP3216C_IOC_MAGIC		'A'
+#define AP3216C_SET_ALS_THRESH	_IOW(AP3216C_IOC_MAGIC, 0x1, struct ap3216c_thresh)	/* 设置ALS阈值 */
+#define AP3216C_GET_ALS_THRESH	_IOR(AP3216C_IOC_MAGIC, 0x2, struct ap3216c_thresh)	/* 读取ALS阈值 */
+#define AP3216C_SET_PS_THRESH	_IOW(AP3216C_IOC_MAGIC, 0x3, struct ap3216c_thresh)	/* 设置PS阈值，最大0x3FF */
+#define AP3216C_GET_PS_THRESH	_IOR(AP3216C_IOC_MAGIC, 0x4, struct ap3216c_thresh)	/* 读取PS阈值 */
+#define AP3216C_SET_CONFIG		_IOW(AP3216C_IOC_MAGIC, 0x5, struct ap3216c_config)	/* 设置量程、增益、积分时间 */
+#define AP3216C_GET_CONFIG		_IOR(AP3216C_IOC_MAGIC, 0x6, struct ap3216c_config)	/* 读取量程、增益、积分时间 */
+#define AP3216C_SET_FORMAT		_IOW(AP3216C_IOC_MAGIC, 0x7, unsigned int)	/* 设置read()格式AP3216C_FMT_xxx */
+#define AP3216C_GET_FORMAT		_IOR(AP3216C_IOC_MAGIC, 0x8, unsigned int)	/* 读取read()格式 */
+
 #endif
 
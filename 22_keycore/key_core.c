@@ -0,0 +1,781 @@
+/***************************************************************
+文件名		: key_core.c
+作者	  	: zhong
+版本	   	: V1.0
+描述	   	: 按键核心模块：设备树解析、GPIO与中断初始化、去抖、事件时间戳，
+			  每个GPIO只有这里的一个中断处理函数；确认的事件分发给所有订阅者。
+			  另外提供每个打开文件的事件队列和字符设备注册，供各个前端直接使用
+其他	   	: 模块参数debounce_us、threaded_irq、hw_debounce、hw_debounce_enotsupp，见下方说明；
+			  每个按键实际使用的去抖方式见/sys/class/<前端名字>/<前端名字>/debounce_mode
+***************************************************************/
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/of.h>
+#include <linux/of_gpio.h>
+#include <linux/of_irq.h>
+#include <linux/irq.h>
+#include <linux/interrupt.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <asm/uaccess.h>
+#include "key_core.h"
+
+#define KEY_CNT 1			   /* 设备号个数 	*/
+#define KEY_DEBOUNCE_SAMPLES 4 /* 线程化去抖时，每个去抖时间内的采样次数 */
+
+/* 每个按键的状态，按key-gpios中的顺序紧凑排列；中断、定时器都以它为参数，O(1)找到按键 */
+struct key_desc
+{
+	unsigned int code;	   /* 按键编号，即key-gpios中的序号 */
+	int gpio;			   /* GPIO编号 */
+	bool active_low;	   /* GPIO_ACTIVE_LOW：低电平表示按下 */
+	int irq;			   /* 中断号 */
+	struct hrtimer timer;  /* 高精度定时器，实现按键去抖 */
+	int last_val;		   /* 上一次确认的按键电平，0按下 1松开 */
+	atomic64_t edge_ns;	   /* 本次抖动第一个边沿的时间，0表示没有待确认的边沿 */
+	bool hw_debounce;	   /* GPIO控制器在硬件里去抖，中断里直接上报，不经过定时器 */
+	char name[16];		   /* GPIO和中断的名字：KEYn */
+};
+
+/* 按键核心 */
+struct key_core
+{
+	struct device_node *nd;	 /* 设备节点 */
+	struct key_desc *keys;	 /* 所有按键，数组大小为nkeys */
+	int nkeys;				 /* 按键个数 */
+	struct list_head subs;	 /* 所有订阅者，去抖确认的事件分发给每一个 */
+	spinlock_t subs_lock;	 /* 保护subs链表，硬件去抖时在硬中断里分发事件 */
+};
+
+static struct key_core key; /* 按键核心 */
+
+/* 去抖时间，单位us，最后一个边沿之后保持稳定这么久才确认按键状态 */
+static unsigned int debounce_us = 15000;
+module_param(debounce_us, uint, 0644);
+MODULE_PARM_DESC(debounce_us, "debounce window in microseconds");
+
+/* 去抖方式：0 硬中断启动高精度定时器，在定时器里读取按键；
+ * 1 线程化中断，在中断线程里采样GPIO完成去抖，不经过定时器 */
+static bool threaded_irq;
+module_param(threaded_irq, bool, 0444);
+MODULE_PARM_DESC(threaded_irq, "debounce in a threaded irq instead of an hrtimer");
+
+/* 优先使用GPIO控制器的硬件去抖(gpiod_set_debounce)，控制器不支持时回退到上面的软件去抖；
+ * 置0则总是软件去抖。只在加载时生效，之后修改debounce_us不会改变硬件去抖时间 */
+static bool hw_debounce = true;
+module_param(hw_debounce, bool, 0444);
+MODULE_PARM_DESC(hw_debounce, "try the gpio controller's debounce filter before software debounce");
+
+/* 测试用：把gpiod_set_debounce()当作返回-ENOTSUPP，在支持硬件去抖的控制器上也走软件回退路径 */
+static bool hw_debounce_enotsupp;
+module_param(hw_debounce_enotsupp, bool, 0444);
+MODULE_PARM_DESC(hw_debounce_enotsupp, "pretend gpiod_set_debounce() returned -ENOTSUPP (tests the software fallback)");
+
+/*
+ * @description	: 读取按键电平，按GPIO_ACTIVE_xxx统一成0按下、1松开
+ * @param - k	: 按键
+ * @return 		: 0 按下；1 松开
+ */
+static int key_get_level(struct key_desc *k)
+{
+	return !gpio_get_value(k->gpio) == k->active_low ? 0 : 1;
+}
+
+/*
+ * @description	: 根据去抖之后的按键电平产生按下/松开事件，分发给每个订阅者
+ * @param - k	: 按键
+ * @param - current_val: 去抖之后的按键电平
+ * @return 		: 无
+ */
+static void key_report(struct key_desc *k, int current_val)
+{
+	struct key_event ev;
+	struct key_subscriber *sub;
+	struct timespec64 ts;
+	unsigned long flags;
+	s64 edge = atomic64_xchg(&k->edge_ns, 0);
+
+	/* 1. 判断按键当前状态：电平没有变化则状态保持，不产生事件 */
+	if (current_val == k->last_val)
+		return;
+	WRITE_ONCE(k->last_val, current_val); /* key_core_pressed()不加锁读取 */
+
+	/* 2. 按input_event的格式填充事件：按下 1 --> 0，value为1；松开 0 --> 1，value为0 */
+	ts = ns_to_timespec64(edge);
+	ev.sec = ts.tv_sec;
+	ev.usec = ts.tv_nsec / NSEC_PER_USEC;
+	ev.type = KEY_EV_KEY;
+	ev.code = KEY_BTN_BASE + k->code;
+	ev.value = !current_val;
+
+	/* 3. 事件分发给每个订阅者；
+	 *    硬中断(硬件去抖)、定时器(软中断)和中断线程都会调用，统一用spin_lock_irqsave */
+	spin_lock_irqsave(&key.subs_lock, flags);
+	list_for_each_entry(sub, &key.subs, node)
+		sub->notify(sub, &ev);
+	spin_unlock_irqrestore(&key.subs_lock, flags);
+}
+
+// 中断处理函数：所有按键共用，dev_id就是触发中断的按键；记录边沿时间，开启高精度定时器，延时debounce_us
+static irqreturn_t key_interrupt(int irq, void *dev_id)
+{
+	struct key_desc *k = dev_id;
+
+	/* 记录抖动中第一个边沿的时间，作为事件的时间戳 */
+	atomic64_cmpxchg(&k->edge_ns, 0, ktime_get_ns());
+
+	/* 硬件去抖：到达这里的边沿已经稳定，直接读取按键上报，省掉一次定时器和软中断 */
+	if (k->hw_debounce)
+	{
+		key_report(k, key_get_level(k));
+		return IRQ_HANDLED;
+	}
+
+	/* 线程化中断：由key_irq_thread()采样去抖 */
+	if (threaded_irq)
+		return IRQ_WAKE_THREAD;
+
+	/* 按键防抖处理：每个边沿都重新开始计时，稳定debounce_us之后再读取按键 */
+	hrtimer_start(&k->timer, ns_to_ktime((u64)debounce_us * NSEC_PER_USEC), HRTIMER_MODE_REL_SOFT);
+	return IRQ_HANDLED;
+}
+
+/*
+ * @description	: 去抖定时器函数：按键稳定之后读取按键值
+ *
+ * @param 	timer	:按键的去抖定时器
+ * @return 		: HRTIMER_NORESTART，只定时一次
+ */
+static enum hrtimer_restart key_timer_function(struct hrtimer *timer)
+{
+	struct key_desc *k = container_of(timer, struct key_desc, timer);
+
+	key_report(k, key_get_level(k));
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * @description	: 中断线程：在线程里采样GPIO完成去抖，不经过定时器。
+ * 				  每debounce_us/KEY_DEBOUNCE_SAMPLES采样一次，电平连续保持debounce_us才确认；
+ * 				  IRQF_ONESHOT使线程运行期间中断保持屏蔽，抖动边沿不会反复唤醒线程
+ * @param - irq	: 中断号
+ * @param - dev_id: 触发中断的按键
+ * @return 		: IRQ_HANDLED
+ */
+static irqreturn_t key_irq_thread(int irq, void *dev_id)
+{
+	struct key_desc *k = dev_id;
+	unsigned int step = max(debounce_us / KEY_DEBOUNCE_SAMPLES, 1U);
+	unsigned int stable = 0;	/* 电平保持不变的时间，us */
+	int val, cur;
+
+	val = key_get_level(k);
+	while (stable < debounce_us)
+	{
+		usleep_range(step, step + step / 4);
+		cur = key_get_level(k);
+		if (cur != val)
+		{
+			val = cur; /* 还在抖动，重新计时 */
+			stable = 0;
+		}
+		else
+			stable += step;
+	}
+
+	key_report(k, val);
+	return IRQ_HANDLED;
+}
+
+/*
+ * @description	: 使用dts初始化按键IO:对设备树属性解析，获取key节点
+ * @param 		: 无
+ * @return 		: 0 成功;其他 失败
+ */
+static int key_parse_dt(void)
+{
+	int i, ret;
+	const char *str;
+	const char *prop;
+
+	/* 设置key所使用的GPIO */
+	/* 1、获取设备节点：key */
+	key.nd = of_find_node_by_path("/key");
+	if (key.nd == NULL)
+	{
+		printk("key node not find!\r\n");
+		return -EINVAL;
+	}
+
+	/* 2.读取status属性 */
+	ret = of_property_read_string(key.nd, "status", &str);
+	if (ret < 0)
+		return -EINVAL;
+
+	if (strcmp(str, "okay"))
+		return -EINVAL;
+
+	/* 3、获取compatible属性值并进行匹配 */
+	ret = of_property_read_string(key.nd, "compatible", &str);
+	if (ret < 0)
+	{
+		printk("key: Failed to get compatible property\n");
+		return -EINVAL;
+	}
+
+	if (strcmp(str, "zhong,key"))
+	{
+		printk("key: Compatible match failed\n");
+		return -EINVAL;
+	}
+
+	/* 4、获取按键个数：key-gpios数组，兼容只有一个按键的key-gpio属性 */
+	prop = of_find_property(key.nd, "key-gpios", NULL) ? "key-gpios" : "key-gpio";
+	key.nkeys = of_gpio_named_count(key.nd, prop);
+	if (key.nkeys <= 0)
+	{
+		printk("can't get %s", prop);
+		return -EINVAL;
+	}
+
+	key.keys = kcalloc(key.nkeys, sizeof(*key.keys), GFP_KERNEL);
+	if (!key.keys)
+		return -ENOMEM;
+
+	/* 5、获取每个按键的GPIO编号与中断号 **************************/
+	for (i = 0; i < key.nkeys; i++)
+	{
+		struct key_desc *k = &key.keys[i];
+		enum of_gpio_flags flags;
+
+		k->code = i;
+		k->last_val = 1; /* 默认松开 */
+		snprintf(k->name, sizeof(k->name), "KEY%d", i);
+
+		k->gpio = of_get_named_gpio_flags(key.nd, prop, i, &flags);
+		if (k->gpio < 0)
+		{
+			printk("can't get %s[%d]", prop, i);
+			ret = -EINVAL;
+			goto free_keys;
+		}
+		k->active_low = flags & OF_GPIO_ACTIVE_LOW;
+
+		/* interrupts属性按顺序给出按键的中断，没有给出的由GPIO得到中断号 */
+		k->irq = irq_of_parse_and_map(key.nd, i);
+		if (!k->irq)
+			k->irq = gpio_to_irq(k->gpio);
+		if (k->irq <= 0)
+		{
+			ret = -EINVAL;
+			goto free_keys;
+		}
+	}
+
+	printk("key: %d keys\r\n", key.nkeys);
+	return 0;
+
+free_keys:
+	kfree(key.keys);
+	key.keys = NULL;
+	return ret;
+}
+
+/*
+ * @description	: 释放前n个按键的中断、定时器和GPIO
+ * @param - n	: 按键个数
+ * @return 		: 无
+ */
+static void key_gpio_free(int n)
+{
+	while (--n >= 0)
+	{
+		free_irq(key.keys[n].irq, &key.keys[n]);
+		hrtimer_cancel(&key.keys[n].timer); /* 中断释放后不会再启动定时器 */
+		gpio_free(key.keys[n].gpio);
+	}
+}
+
+/*
+ * @description	: 尝试让GPIO控制器在硬件里滤除抖动
+ * @param - k	: 按键
+ * @return 		: 0 使用硬件去抖；其他 控制器拒绝或不能使用，回退到软件去抖
+ */
+static int key_set_hw_debounce(struct key_desc *k)
+{
+	/* 硬件去抖在硬中断里读取电平，会睡眠的GPIO(如I2C扩展芯片)不能使用 */
+	if (!hw_debounce || gpio_cansleep(k->gpio))
+		return -EINVAL;
+	if (hw_debounce_enotsupp)
+		return -ENOTSUPP;
+	return gpiod_set_debounce(gpio_to_desc(k->gpio), debounce_us);
+}
+
+/* 对每个按键的GPIO与对应的中断进行初始化 **************************/
+static int key_gpio_init(void)
+{
+	int i, ret;
+	unsigned long irq_flags;
+	struct key_desc *k;
+	bool thread;
+
+	for (i = 0; i < key.nkeys; i++)
+	{
+		k = &key.keys[i];
+
+		// gpio申请
+		ret = gpio_request(k->gpio, k->name);
+		if (ret)
+		{
+			printk(KERN_ERR "key: Failed to request %s\n", k->name);
+			goto free_keys;
+		}
+
+		/* 将GPIO设置为输入模式 */
+		gpio_direction_input(k->gpio);
+
+		/* 优先让GPIO控制器在硬件里滤除抖动，控制器拒绝时回退到软件去抖 */
+		ret = key_set_hw_debounce(k);
+		k->hw_debounce = !ret;
+		thread = threaded_irq && !k->hw_debounce;
+		if (hw_debounce && ret)
+			printk("key: %s no hardware debounce (%d), using %s\n", k->name, ret,
+				   thread ? "threaded" : "hrtimer");
+
+		/* 去抖定时器在申请中断之前初始化，中断一来就可能启动它；
+		 * 软中断模式到期，回调与订阅者处于相同的加锁规则下 */
+		hrtimer_init(&k->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+		k->timer.function = key_timer_function;
+
+		/* 获取设备树中指定的中断触发类型 */
+		irq_flags = irq_get_trigger_type(k->irq);
+		if (IRQF_TRIGGER_NONE == irq_flags)
+			irq_flags = IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING;
+
+		/* 申请中断：所有按键共用一个处理函数，dev_id为按键自己 */
+		ret = request_threaded_irq(k->irq, key_interrupt, thread ? key_irq_thread : NULL,
+								   irq_flags | (thread ? IRQF_ONESHOT : 0), k->name, k);
+		if (ret)
+		{
+			gpio_free(k->gpio);
+			goto free_keys;
+		}
+	}
+
+	return 0;
+
+free_keys:
+	key_gpio_free(i);
+	return ret;
+}
+
+/*
+ * @description	: 订阅按键事件，之后去抖确认的每个事件都会调用sub->notify()
+ * @param - sub	: 订阅者，notify必须已经设置
+ * @return 		: 0 成功;其他 失败
+ */
+int key_core_subscribe(struct key_subscriber *sub)
+{
+	if (!sub->notify)
+		return -EINVAL;
+
+	spin_lock_irq(&key.subs_lock);
+	list_add_tail(&sub->node, &key.subs);
+	spin_unlock_irq(&key.subs_lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(key_core_subscribe);
+
+/*
+ * @description	: 取消订阅，返回之后notify()不会再被调用
+ * @param - sub	: 订阅者
+ * @return 		: 无
+ */
+void key_core_unsubscribe(struct key_subscriber *sub)
+{
+	/* notify()在subs_lock内调用，摘下之后不会再访问sub */
+	spin_lock_irq(&key.subs_lock);
+	list_del(&sub->node);
+	spin_unlock_irq(&key.subs_lock);
+}
+EXPORT_SYMBOL_GPL(key_core_unsubscribe);
+
+/*
+ * @description	: 查询按键去抖之后的状态，不访问GPIO
+ * @param - code: 按键编号，即key-gpios中的序号
+ * @return 		: 1 按下；0 松开；-EINVAL 没有这个按键
+ */
+int key_core_pressed(unsigned int code)
+{
+	if (code >= key.nkeys)
+		return -EINVAL;
+	return !READ_ONCE(key.keys[code].last_val);
+}
+EXPORT_SYMBOL_GPL(key_core_pressed);
+
+/*
+ * @description	: 按键个数，事件的code为KEY_BTN_BASE + 0 ~ 按键个数-1
+ * @return 		: 按键个数
+ */
+int key_core_nkeys(void)
+{
+	return key.nkeys;
+}
+EXPORT_SYMBOL_GPL(key_core_nkeys);
+
+/*
+ * @description	: 打开文件的订阅回调：事件放入本文件的队列，只唤醒这个文件自己的等待队列；
+ * 				  唤醒时带上EPOLLIN，epoll只唤醒关心读事件的等待者，EPOLLEXCLUSIVE时只唤醒一个
+ * @param - sub	: 本文件的订阅者
+ * @param - ev	: 事件
+ * @return 		: 无
+ */
+static void key_client_notify(struct key_subscriber *sub, const struct key_event *ev)
+{
+	struct key_client *c = container_of(sub, struct key_client, sub);
+
+	if (!kfifo_put(&c->fifo, *ev))
+		return;
+	wake_up_interruptible_poll(&c->wait, EPOLLIN | EPOLLRDNORM);
+	if (c->fasync)
+		kill_fasync(&c->fasync, SIGIO, POLL_IN);
+}
+
+/*
+ * @description		: 打开设备：为本文件分配事件队列并订阅事件
+ * @param - inode 	: 传递给驱动的inode
+ * @param - filp 	: 设备文件，private_data指向本文件的struct key_client
+ * @return 			: 0 成功;其他 失败
+ */
+int key_client_open(struct inode *inode, struct file *filp)
+{
+	struct key_client *c;
+	int ret;
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+	INIT_KFIFO(c->fifo);
+	mutex_init(&c->read_lock);
+	init_waitqueue_head(&c->wait);
+	c->sub.notify = key_client_notify;
+
+	/* read_iter支持IOCB_NOWAIT：io_uring可以先非阻塞地读，没有事件时等poll就绪再重试 */
+	filp->f_mode |= FMODE_NOWAIT;
+	filp->private_data = c;
+
+	/* 只接收打开之后的事件 */
+	ret = key_core_subscribe(&c->sub);
+	if (ret)
+		kfree(c);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(key_client_open);
+
+/*
+ * @description		: 关闭/释放设备：取消订阅，释放事件队列
+ * @param - filp 	: 要关闭的设备文件(文件描述符)
+ * @return 			: 0 成功;其他 失败
+ */
+int key_client_release(struct inode *inode, struct file *filp)
+{
+	struct key_client *c = filp->private_data;
+
+	/* 取消订阅之后核心不会再访问c */
+	key_core_unsubscribe(&c->sub);
+	fasync_helper(-1, filp, 0, &c->fasync);
+	kfree(c);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(key_client_release);
+
+/*
+ * @description     : 从设备读取数据，对应用户空间的App的read()函数，也供io_uring等异步读取使用
+ * 					  一次返回本文件队列中尽可能多的按键事件(struct key_event)；
+ * 					  队列中有事件时直接返回，不进入等待
+ * @param – iocb        : 本次读取的控制块，ki_filp为设备文件
+ * @param – to      : 返回给用户空间的数据缓冲区
+ * @return          : 读取的字节数，如果为负值，表示读取失败；
+ * 					  O_NONBLOCK或IOCB_NOWAIT时没有事件返回-EAGAIN
+ */
+ssize_t key_client_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct key_client *c = iocb->ki_filp->private_data;
+	bool nowait = (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+	struct key_event ev[KEY_FIFO_SIZE];
+	size_t n, copied, i;
+	ssize_t ret = 0;
+
+	/* 1. 非阻塞时不能睡眠等锁，另一个读者正在读就返回-EAGAIN */
+	if (nowait)
+	{
+		if (!mutex_trylock(&c->read_lock))
+			return -EAGAIN;
+	}
+	else if (mutex_lock_interruptible(&c->read_lock))
+		return -ERESTARTSYS;
+
+	/* 2. 队列为空时：非阻塞直接返回，阻塞则加入等待序列，只有按键变化时，才会被唤醒 */
+	while (kfifo_is_empty(&c->fifo))
+	{
+		mutex_unlock(&c->read_lock);
+		if (nowait)
+			return -EAGAIN;
+		ret = wait_event_interruptible(c->wait, !kfifo_is_empty(&c->fifo));
+		if (ret)
+			return ret;
+		if (mutex_lock_interruptible(&c->read_lock))
+			return -ERESTARTSYS;
+	}
+
+	/* 3. 兼容旧接口：缓冲区放不下一个事件时，只返回最早的一个按键状态(int) */
+	if (iov_iter_count(to) < sizeof(struct key_event))
+	{
+		int status = KEY_KEEP;
+
+		if (kfifo_get(&c->fifo, &ev[0]))
+			status = ev[0].value ? KEY_PRESS : KEY_RELEASE;
+		ret = copy_to_iter(&status, sizeof(int), to) == sizeof(int) ? 0 : -EFAULT;
+		goto out;
+	}
+
+	/* 4. 将队列中的事件一次性发送给应用程序，直到用户缓冲区满；
+	 *    先peek再取出，拷贝失败的事件仍留在队列中 */
+	while (iov_iter_count(to) >= sizeof(struct key_event))
+	{
+		n = min_t(size_t, iov_iter_count(to) / sizeof(struct key_event), KEY_FIFO_SIZE);
+		n = kfifo_out_peek(&c->fifo, ev, n);
+		if (!n)
+			break;
+		copied = copy_to_iter(ev, n * sizeof(struct key_event), to) / sizeof(struct key_event);
+		ret += copied * sizeof(struct key_event);
+		for (i = 0; i < copied; i++)
+			kfifo_skip(&c->fifo);
+		if (copied < n)
+		{
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+	}
+out:
+	mutex_unlock(&c->read_lock);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(key_client_read_iter);
+
+/*
+ * @description     : poll函数，按本文件自己的队列报告是否可读
+ * @param - filp    : 要打开的设备文件(文件描述符)
+ * @param - wait    : 等待列表(poll_table)
+ * @return          : 设备或者资源状态，
+ */
+__poll_t key_client_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct key_client *c = filp->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &c->wait, wait);
+	if (!kfifo_is_empty(&c->fifo)) /* 本文件的队列中有事件 */
+		mask = EPOLLIN | EPOLLRDNORM;
+	return mask;
+}
+EXPORT_SYMBOL_GPL(key_client_poll);
+
+/*
+ * @description		: fasync函数，用于处理异步通知；只有本文件有新事件才发送SIGIO
+ * @param – fd		: 文件描述符
+ * @param – filp	: 要打开的设备文件(文件描述符)
+ * @param – on		: 模式
+ * @return			: 负数表示函数执行失败
+ */
+int key_client_fasync(int fd, struct file *filp, int on)
+{
+	struct key_client *c = filp->private_data;
+
+	return fasync_helper(fd, filp, on, &c->fasync);
+}
+EXPORT_SYMBOL_GPL(key_client_fasync);
+
+/*
+ * @description		: ioctl函数：App调用ioctl()查询本文件队列的深度
+ * @param - filp 	: 要打开的设备文件(文件描述符)
+ * @param - cmd 	: 应用程序发送过来的命令
+ * @param - arg 	: 参数，KEY_GETQLEN_CMD时为unsigned int指针
+ * @return 			: 0 成功;其他 失败
+ */
+long key_client_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct key_client *c = filp->private_data;
+	unsigned int len;
+
+	switch (cmd)
+	{
+	case KEY_GETQLEN_CMD:
+		/* 队列中待读取的事件数，只是一个快照：去抖随时可能再放入事件 */
+		len = kfifo_len(&c->fifo);
+		return put_user(len, (unsigned int __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+EXPORT_SYMBOL_GPL(key_client_ioctl);
+
+/*
+ * @description	: sysfs属性debounce_mode：按key-gpios的顺序列出每个按键实际使用的去抖方式，
+ * 				  hardware 控制器硬件去抖；hrtimer 高精度定时器；threaded 线程化中断采样
+ * @param - dev	: 前端的设备
+ * @param - attr: 属性
+ * @param - buf	: 输出缓冲区
+ * @return 		: 输出的字节数
+ */
+static ssize_t debounce_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	const char *mode;
+	int i;
+
+	for (i = 0; i < key.nkeys; i++)
+	{
+		if (key.keys[i].hw_debounce)
+			mode = "hardware";
+		else
+			mode = threaded_irq ? "threaded" : "hrtimer";
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s%s", i ? " " : "", mode);
+	}
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+static DEVICE_ATTR_RO(debounce_mode);
+
+static struct attribute *key_core_attrs[] = {
+	&dev_attr_debounce_mode.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(key_core);
+
+/*
+ * @description	: 注册字符设备：设备号、cdev、类和设备节点/dev/<name>，
+ * 				  设备带有debounce_mode属性
+ * @param - cd	: 前端的字符设备
+ * @param - name: 设备名字，也是类的名字
+ * @param - fops: 前端的设备操作函数
+ * @return 		: 0 成功;其他 失败
+ */
+int key_chrdev_register(struct key_chrdev *cd, const char *name,
+						const struct file_operations *fops)
+{
+	int ret;
+
+	/* 1、创建设备号 */
+	ret = alloc_chrdev_region(&cd->devid, 0, KEY_CNT, name); /* 申请设备号 */
+	if (ret < 0)
+	{
+		pr_err("%s Couldn't alloc_chrdev_region, ret=%d\r\n", name, ret);
+		return ret;
+	}
+
+	/* 2、初始化cdev */
+	cdev_init(&cd->cdev, fops);
+	cd->cdev.owner = fops->owner;
+
+	/* 3、添加一个cdev */
+	ret = cdev_add(&cd->cdev, cd->devid, KEY_CNT);
+	if (ret < 0)
+		goto del_unregister;
+
+	/* 4、创建类 */
+	cd->class = class_create(fops->owner, name);
+	if (IS_ERR(cd->class))
+	{
+		ret = PTR_ERR(cd->class);
+		goto del_cdev;
+	}
+
+	/* 5、创建设备，同时创建sysfs属性 */
+	cd->device = device_create_with_groups(cd->class, NULL, cd->devid, NULL, key_core_groups, name);
+	if (IS_ERR(cd->device))
+	{
+		ret = PTR_ERR(cd->device);
+		goto destroy_class;
+	}
+
+	return 0;
+
+destroy_class:
+	class_destroy(cd->class);
+del_cdev:
+	cdev_del(&cd->cdev);
+del_unregister:
+	unregister_chrdev_region(cd->devid, KEY_CNT);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(key_chrdev_register);
+
+/*
+ * @description	: 注销key_chrdev_register()注册的字符设备
+ * @param - cd	: 前端的字符设备
+ * @return 		: 无
+ */
+void key_chrdev_unregister(struct key_chrdev *cd)
+{
+	cdev_del(&cd->cdev);						  /*  删除cdev */
+	unregister_chrdev_region(cd->devid, KEY_CNT); /* 注销设备号 */
+	device_destroy(cd->class, cd->devid);		  /*注销设备 */
+	class_destroy(cd->class);					  /* 注销类 */
+}
+EXPORT_SYMBOL_GPL(key_chrdev_unregister);
+
+/*
+ * @description	: 驱动入口函数
+ * @param 		: 无
+ * @return 		: 无
+ */
+static int __init key_core_init(void)
+{
+	int ret;
+
+	/* 订阅者链表 */
+	INIT_LIST_HEAD(&key.subs);
+	spin_lock_init(&key.subs_lock);
+
+	/* 设备树解析 */
+	ret = key_parse_dt();
+	if (ret)
+		return ret;
+
+	/* GPIO 中断初始化 */
+	ret = key_gpio_init();
+	if (ret)
+	{
+		kfree(key.keys);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * @description	: 驱动出口函数：前端模块引用了本模块的符号，卸载时已经没有订阅者
+ * @param 		: 无
+ * @return 		: 无
+ */
+static void __exit key_core_exit(void)
+{
+	key_gpio_free(key.nkeys); /* 释放中断、定时器和IO */
+	kfree(key.keys);
+}
+
+module_init(key_core_init);
+module_exit(key_core_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("zhong");
+MODULE_INFO(intree, "Y");
@@ -0,0 +1,98 @@
+#ifndef KEY_CORE_H
+#define KEY_CORE_H
+/***************************************************************
+文件名		: key_core.h
+作者	  	: zhong
+版本	   	: V1.0
+描述	   	: 按键核心模块对外接口：事件格式、事件订阅、每个打开文件的事件队列、
+			  字符设备注册。11_key、13_irq、14_blockio、15_noblockio、16_asyncnoti
+			  只是在它上面的薄前端，各自注册/dev/key、/dev/keyirq、/dev/blockio、
+			  /dev/noblockio、/dev/asyncnoti，可以同时加载；
+			  20_input的独立按键作为订阅者把事件转换成input事件
+其他	   	: 先insmod key_core.ko，再加载前端模块
+***************************************************************/
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/kfifo.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+
+#define KEY_FIFO_SIZE 16   /* 每个打开的文件缓存的事件数，必须是2的幂 */
+#define KEY_EV_KEY 0x01	   /* 事件类型，与input子系统的EV_KEY相同 */
+#define KEY_BTN_BASE 0x100 /* 按键编码从BTN_0开始：code = BTN_0 + 序号 */
+
+/* ioctl命令：查询本文件队列中还有多少个事件没有读取 */
+#define KEY_GETQLEN_CMD (_IOR(0XEF, 0x1, unsigned int))
+
+/* 定义按键三种状态，兼容只读一个int的旧接口************************ */
+enum key_status
+{
+	KEY_PRESS = 0, /* 按键按下 */
+	KEY_RELEASE,   /* 按键松开 */
+	KEY_KEEP,	   /* 按键状态保持 */
+};
+
+/* 按键事件，与应用程序共用：read()一次返回尽可能多的事件；
+ * 布局与<linux/input.h>中的struct input_event相同，应用程序可以直接按input_event解析 */
+struct key_event
+{
+	__kernel_ulong_t sec;	/* 按键第一个边沿的时间，CLOCK_MONOTONIC */
+	__kernel_ulong_t usec;
+	__u16 type;				/* KEY_EV_KEY */
+	__u16 code;				/* KEY_BTN_BASE + key-gpios中的序号 */
+	__s32 value;			/* 1 按下，0 松开，与input子系统一致 */
+};
+
+/* 事件订阅者：去抖确认一个事件之后，核心依次调用每个订阅者的notify()。
+ * notify()处于硬中断(硬件去抖)、软中断(定时器去抖)或中断线程上下文，
+ * 并且持有订阅链表的锁(关中断)，不能睡眠 */
+struct key_subscriber
+{
+	struct list_head node; /* 挂在核心的订阅链表上 */
+	void (*notify)(struct key_subscriber *sub, const struct key_event *ev);
+};
+
+/* 每个打开的文件各自的事件队列：notify()是唯一的写者，read()是唯一的读者，kfifo无需加锁 */
+struct key_client
+{
+	struct key_subscriber sub;							  /* 订阅核心的事件 */
+	DECLARE_KFIFO(fifo, struct key_event, KEY_FIFO_SIZE); /* 事件队列，满时丢弃新事件 */
+	struct mutex read_lock;								  /* 同一个文件被多个线程read时保证只有一个读者 */
+	wait_queue_head_t wait;								  /* 本文件的读等待队列，只有本文件有新事件时才唤醒 */
+	struct fasync_struct *fasync;						  /* 本文件的异步通知，没有启用时为NULL */
+};
+
+/* 前端注册的字符设备 */
+struct key_chrdev
+{
+	dev_t devid;		   /* 设备号 	 */
+	struct cdev cdev;	   /* cdev 	*/
+	struct class *class;   /* 类 		*/
+	struct device *device; /* 设备 	 */
+};
+
+/* 事件订阅 */
+int key_core_subscribe(struct key_subscriber *sub);
+void key_core_unsubscribe(struct key_subscriber *sub);
+int key_core_pressed(unsigned int code);
+int key_core_nkeys(void);
+
+/* 每个打开文件的事件队列，可以直接作为前端的file_operations成员 */
+int key_client_open(struct inode *inode, struct file *filp);
+int key_client_release(struct inode *inode, struct file *filp);
+ssize_t key_client_read_iter(struct kiocb *iocb, struct iov_iter *to);
+__poll_t key_client_poll(struct file *filp, struct poll_table_struct *wait);
+int key_client_fasync(int fd, struct file *filp, int on);
+long key_client_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+
+/* 字符设备注册 */
+int key_chrdev_register(struct key_chrdev *cd, const char *name,
+						const struct file_operations *fops);
+void key_chrdev_unregister(struct key_chrdev *cd);
+
+#endif